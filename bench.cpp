@@ -0,0 +1,336 @@
+// Parsing benchmarks : make bench
+#include "ropts.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace ropts;
+
+/******************************************************************************
+ * Allocation counting : replace the global operator new.
+ */
+static std::size_t nb_allocations = 0;
+
+void * operator new(std::size_t size) {
+    nb_allocations += 1;
+    if(void * p = std::malloc(size > 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept {
+    std::free(p);
+}
+void operator delete(void * p, std::size_t) noexcept {
+    std::free(p);
+}
+// Used by std::pmr::new_delete_resource, the default memory resource.
+void * operator new(std::size_t size, std::align_val_t alignment) {
+    nb_allocations += 1;
+    std::size_t align = std::max(std::size_t(alignment), sizeof(void *));
+    void * p = nullptr;
+    if(posix_memalign(&p, align, size > 0 ? size : 1) == 0) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void * p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+/******************************************************************************
+ * Measurement : run is timed, reset is not. Repeated until enough time is spent.
+ */
+struct Measure {
+    double ns_per_run;
+    double allocations_per_run;
+};
+
+template <typename Run, typename Reset> static Measure measure(Run && run, Reset && reset) {
+    using Clock = std::chrono::steady_clock;
+    constexpr auto min_total_duration = std::chrono::milliseconds(100);
+    constexpr std::size_t min_nb_runs = 3;
+
+    Clock::duration total_duration{0};
+    std::size_t total_allocations = 0;
+    std::size_t nb_runs = 0;
+    while(nb_runs < min_nb_runs || total_duration < min_total_duration) {
+        reset();
+        std::size_t allocations_before = nb_allocations;
+        auto start = Clock::now();
+        run();
+        auto end = Clock::now();
+        total_allocations += nb_allocations - allocations_before;
+        total_duration += end - start;
+        nb_runs += 1;
+    }
+    double total_ns =
+        double(std::chrono::duration_cast<std::chrono::nanoseconds>(total_duration).count());
+    return {total_ns / double(nb_runs), double(total_allocations) / double(nb_runs)};
+}
+
+// Sink for computed values, prevents the compiler from removing computations.
+static volatile double sink = 0;
+
+/******************************************************************************
+ * Benchmarks.
+ */
+static std::string option_name(std::size_t i) {
+    return "option-" + std::to_string(i);
+}
+
+// Application::parse with nb_options OptionMultiple<int>, and nb_tokens (2 per occurrence).
+static void bench_parse(std::size_t nb_options, std::size_t nb_tokens, bool prescan) {
+    Application app{"bench"};
+    std::vector<std::unique_ptr<OptionMultiple<int>>> options;
+    for(std::size_t i = 0; i < nb_options; ++i) {
+        options.emplace_back(new OptionMultiple<int>{CowStr(option_name(i))});
+        options.back()->value_name = "N";
+        app.add(*options.back());
+    }
+    app.enable_prescan(prescan);
+
+    std::vector<std::string> tokens;
+    tokens.reserve(nb_tokens);
+    for(std::size_t i = 0; tokens.size() + 2 <= nb_tokens; ++i) {
+        std::size_t option = (i * 7919) % nb_options; // Spread accesses
+        tokens.emplace_back("--" + option_name(option));
+        tokens.emplace_back(std::to_string(i));
+    }
+    std::vector<char const *> argv{"bench"};
+    for(std::string const & token : tokens) {
+        argv.push_back(token.c_str());
+    }
+
+    Measure m = measure(
+        [&] { app.parse({int(argv.size()), argv.data()}); },
+        [&] {
+            for(auto & option : options) {
+                decltype(option->values)().swap(option->values); // Release storage
+            }
+        });
+    std::printf(
+        "parse%s  options=%-5zu tokens=%-8zu : %8.2f ns/token, %10.1f allocations/parse\n",
+        prescan ? "+prescan" : "        ",
+        nb_options,
+        tokens.size(),
+        m.ns_per_run / double(tokens.size()),
+        m.allocations_per_run);
+}
+
+// Same as bench_parse, with an OptionTable.
+static void bench_parse_table(std::size_t nb_options, std::size_t nb_tokens) {
+    OptionTable table;
+    std::vector<std::string> names;
+    for(std::size_t i = 0; i < nb_options; ++i) {
+        names.push_back(option_name(i));
+    }
+    for(std::string const & name : names) {
+        table.add_multiple<int>({'\0', name}, "N");
+    }
+
+    std::vector<std::string> tokens;
+    tokens.reserve(nb_tokens);
+    for(std::size_t i = 0; tokens.size() + 2 <= nb_tokens; ++i) {
+        std::size_t option = (i * 7919) % nb_options;
+        tokens.emplace_back("--" + option_name(option));
+        tokens.emplace_back(std::to_string(i));
+    }
+    std::vector<char const *> argv{"bench"};
+    for(std::string const & token : tokens) {
+        argv.push_back(token.c_str());
+    }
+
+    // Values accumulate between runs : the table has no reset, and allocations are amortized.
+    Measure m = measure([&] { table.parse({int(argv.size()), argv.data()}); }, [] {});
+    std::printf(
+        "parse(table)   options=%-5zu tokens=%-8zu : %8.2f ns/token, %10.1f allocations/parse\n",
+        nb_options,
+        tokens.size(),
+        m.ns_per_run / double(tokens.size()),
+        m.allocations_per_run);
+}
+
+// ValueTrait<T>::parse(string_view) on its own.
+template <typename T> static void bench_value_parse(char const * type_name, char const * format) {
+    constexpr std::size_t nb_values = 100000;
+    std::vector<std::string> texts;
+    for(std::size_t i = 0; i < nb_values; ++i) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), format, int(i) - int(nb_values / 2));
+        texts.emplace_back(buf);
+    }
+    Measure m = measure(
+        [&] {
+            double sum = 0;
+            for(std::string const & text : texts) {
+                sum += double(ValueTrait<T>::parse(text, "value"));
+            }
+            sink = sum;
+        },
+        [] {});
+    std::printf(
+        "ValueTrait<%s>::parse%*s : %8.2f ns/value, %10.3f allocations/value\n",
+        type_name,
+        int(12 - std::char_traits<char>::length(type_name)),
+        "",
+        m.ns_per_run / double(nb_values),
+        m.allocations_per_run / double(nb_values));
+}
+
+// Application::write_usage with nb_options
+static void bench_usage(std::size_t nb_options) {
+    Application app{"bench"};
+    std::vector<std::unique_ptr<OptionSingle<int>>> options;
+    for(std::size_t i = 0; i < nb_options; ++i) {
+        // Short names must be unique : only the first 26 options have one
+        if(i < 26) {
+            options.emplace_back(new OptionSingle<int>{char('a' + i), CowStr(option_name(i))});
+        } else {
+            options.emplace_back(new OptionSingle<int>{CowStr(option_name(i))});
+        }
+        options.back()->value_name = "N";
+        options.back()->help_text = "Help text of the option, of typical length";
+        app.add(*options.back());
+    }
+    std::FILE * out = std::fopen("/dev/null", "w");
+    if(out == nullptr) {
+        std::perror("fopen /dev/null");
+        return;
+    }
+    Measure m = measure([&] { app.write_usage(out); }, [] {});
+    std::fclose(out);
+    std::printf(
+        "write_usage     options=%-5zu %16s : %8.2f ns/option, %10.1f allocations/call\n",
+        nb_options,
+        "",
+        m.ns_per_run / double(nb_options),
+        m.allocations_per_run);
+}
+
+// Startup : from nothing to options ready, for a program run with a short command line.
+// Option construction, Application registration, index building, and parsing of one option.
+// Option storage is allocated once, options are constructed in place and destroyed by reset.
+static void bench_startup(std::size_t nb_options, bool reserve) {
+    using Option = OptionSingle<int>;
+    std::vector<std::string> names;
+    for(std::size_t i = 0; i < nb_options; ++i) {
+        names.push_back(option_name(i));
+    }
+    std::unique_ptr<std::aligned_storage_t<sizeof(Option), alignof(Option)>[]> storage{
+        new std::aligned_storage_t<sizeof(Option), alignof(Option)>[nb_options]};
+    auto options = reinterpret_cast<Option *>(storage.get());
+    std::optional<Application> app;
+    std::string last = "--" + names.back();
+    std::vector<char const *> argv{"bench", last.c_str(), "42"};
+
+    auto destroy = [&] {
+        if(app) {
+            app.reset();
+            for(std::size_t i = 0; i < nb_options; ++i) {
+                options[i].~Option();
+            }
+        }
+    };
+    auto run = [&] {
+        for(std::size_t i = 0; i < nb_options; ++i) {
+            new(&options[i]) Option{CowStr::borrowed(names[i])}; // As a literal name
+        }
+        app.emplace("bench");
+        if(reserve) {
+            app->reserve(nb_options);
+        }
+        for(std::size_t i = 0; i < nb_options; ++i) {
+            app->add(options[i]);
+        }
+        app->parse({int(argv.size()), argv.data()});
+        sink = double(*options[nb_options - 1].value);
+    };
+    Measure m = measure(run, destroy);
+    destroy();
+    std::printf(
+        "startup%s options=%-5zu %16s : %8.2f ns/option, %10.1f allocations/startup\n",
+        reserve ? "+reserve" : "        ",
+        nb_options,
+        "",
+        m.ns_per_run / double(nb_options),
+        m.allocations_per_run);
+#ifdef ROPTS_INSTRUMENTATION
+    // One more run for per startup counters
+    instrumentation() = {};
+    run();
+    destroy();
+    Instrumentation const & counters = instrumentation();
+    double total_ns = double((counters.index_duration + counters.parse_duration).count());
+    std::printf(
+        "  instrumented : index %.0f%%, parse %.0f%% of index+parse, %zu allocations by ropts\n",
+        100. * double(counters.index_duration.count()) / total_ns,
+        100. * double(counters.parse_duration.count()) / total_ns,
+        counters.nb_allocations);
+#endif
+}
+
+// Startup of a typical small tool : options are locals, registered with add({...}).
+static void bench_startup_small() {
+    char const * argv[] = {"bench", "-v", "--jobs", "4", "--output=out"};
+    Measure m = measure(
+        [&] {
+            Flag verbose{'v', "verbose"};
+            Flag quiet{'q', "quiet"};
+            OptionSingle<int> jobs{'j', "jobs"};
+            OptionSingle<string_view> output{'o', "output"};
+            OptionSingle<string_view> input{'i', "input"};
+            OptionMultiple<string_view> defines{'D', "define"};
+            OptionSingle<double> ratio{"ratio"};
+            Flag dry_run{'n', "dry-run"};
+            Application app{"bench"};
+            app.add({&verbose, &quiet, &jobs, &output, &input, &defines, &ratio, &dry_run});
+            app.parse({5, argv});
+            sink = double(*jobs.value);
+        },
+        [] {});
+    std::printf(
+        "startup(small)  options=8     %16s : %8.2f ns/startup, %10.1f allocations/startup\n",
+        "",
+        m.ns_per_run,
+        m.allocations_per_run);
+}
+
+int main() {
+    for(std::size_t nb_options : {10, 100, 1000}) {
+        for(std::size_t nb_tokens : {10, 1000, 100000, 1000000}) {
+            bench_parse(nb_options, nb_tokens, false);
+        }
+    }
+    for(std::size_t nb_tokens : {1000, 1000000}) {
+        bench_parse(100, nb_tokens, true);
+    }
+    for(std::size_t nb_options : {10, 1000}) {
+        bench_parse_table(nb_options, 100000);
+    }
+    bench_value_parse<int>("int", "%i");
+    bench_value_parse<long>("long", "%i000");
+    bench_value_parse<float>("float", "%i.25");
+    bench_value_parse<double>("double", "%i.125e-3");
+    bench_value_parse<long double>("long double", "%i.125e3");
+    for(std::size_t nb_options : {100, 500}) {
+        bench_usage(nb_options);
+    }
+    for(std::size_t nb_options : {10, 100, 1000}) {
+        bench_startup(nb_options, false);
+        bench_startup(nb_options, true);
+    }
+    bench_startup_small();
+    return 0;
+}
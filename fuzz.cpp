@@ -0,0 +1,148 @@
+// Fuzzing entry point : Application::parse and ValueTrait<T> parsing.
+// Input is split at '\0' bytes into command line elements.
+// libFuzzer : make fuzz.bin (clang++). AFL++ or replay of inputs : make fuzz-standalone.bin, which
+// runs each file given as argument, or stdin if none.
+#include "ropts.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace ropts;
+
+// Invariant violations must crash to be reported, even with NDEBUG.
+#define FUZZ_CHECK(condition)                                                                      \
+    do {                                                                                           \
+        if(!(condition)) {                                                                         \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::abort();                                                                          \
+        }                                                                                          \
+    } while(false)
+
+// Values that parse must be written, and parse back to the same value.
+template <typename T> static void fuzz_value(string_view text) {
+    ParseError error;
+    T value{};
+    if(ValueTrait<T>::try_parse(text, "value", value, error)) {
+        FUZZ_CHECK(!error);
+        if(value == value) { // Not NaN
+            std::string buffer;
+            std::size_t size = ValueTrait<T>::write(buffer, value);
+            FUZZ_CHECK(size == buffer.size());
+            T parsed_back{};
+            FUZZ_CHECK(ValueTrait<T>::try_parse(buffer, "value", parsed_back, error));
+            FUZZ_CHECK(parsed_back == value);
+        }
+    } else {
+        FUZZ_CHECK(error.code == ErrorCode::InvalidValue);
+        FUZZ_CHECK(!error.message().empty());
+    }
+}
+
+static void fuzz_list(string_view text) {
+    ParseError error;
+    std::vector<int> values;
+    if(ValueTrait<List<int>>::try_parse(text, "list", values, error)) {
+        std::string buffer;
+        ValueTrait<List<int>>::write(buffer, values);
+        std::vector<int> parsed_back;
+        FUZZ_CHECK(ValueTrait<List<int>>::try_parse(buffer, "list", parsed_back, error));
+        FUZZ_CHECK(parsed_back == values);
+    } else {
+        FUZZ_CHECK(!error.message().empty());
+    }
+}
+
+static void fuzz_parse(std::vector<char const *> const & argv) {
+    Flag verbose{'v', "verbose"};
+    Flag quiet{'q', "quiet"};
+    OptionSingle<int> jobs{'j', "jobs"};
+    OptionSingle<double> ratio{'r', "ratio"};
+    OptionSingle<string_view> output{'o', "output"};
+    OptionMultiple<long> sizes{'s', "size"};
+    OptionMultiple<List<int>> ids{"ids"};
+    OptionSingle<std::tuple<int, string_view>> pair{'p', "pair-of-values"};
+    pair.value_name = {"N", "NAME"};
+    OptionGroup verbosity{
+        "verbosity", {&verbose, &quiet}, OptionGroup::Constraint::MutuallyExclusive};
+    Positionals positionals;
+
+    Application app{"fuzz"};
+    app.add({&verbose, &quiet, &jobs, &ratio, &output, &sizes, &ids, &pair});
+    app.add(verbosity);
+    app.set_positionals(positionals);
+    Flag sub_flag{'f', "flag"};
+    app.add_subcommand("sub", [&](Application & sub) { sub.add(sub_flag); });
+
+    CommandLine command_line{int(argv.size()), argv.data()};
+    ParseError error;
+    if(app.try_parse(command_line, error)) {
+        FUZZ_CHECK(!(verbose.value() && quiet.value()));
+        FUZZ_CHECK(positionals.size() < argv.size());
+    } else {
+        FUZZ_CHECK(error.code != ErrorCode::None);
+        FUZZ_CHECK(error.element_index < argv.size());
+        FUZZ_CHECK(!error.message().empty());
+    }
+
+    // The const parse must agree on success
+    ParseResults results = app.make_results();
+    ParseError const_error;
+    bool const_success = app.try_parse(command_line, results, const_error);
+    if(app.selected_subcommand() == nullptr) {
+        FUZZ_CHECK(const_success == !error);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const * data, std::size_t size) {
+    // Elements are views in a null terminated copy
+    std::string input(reinterpret_cast<char const *>(data), size);
+    std::vector<char const *> argv{"fuzz"};
+    std::size_t start = 0;
+    while(start < input.size()) {
+        argv.push_back(input.c_str() + start);
+        start += std::char_traits<char>::length(input.c_str() + start) + 1;
+    }
+    for(std::size_t i = 1; i < argv.size(); ++i) {
+        string_view element = argv[i];
+        fuzz_value<int>(element);
+        fuzz_value<long>(element);
+        fuzz_value<float>(element);
+        fuzz_value<double>(element);
+        fuzz_list(element);
+    }
+    fuzz_parse(argv);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static void run_stream(std::FILE * in) {
+    std::vector<std::uint8_t> data;
+    std::uint8_t chunk[4096];
+    std::size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+int main(int argc, char * argv[]) {
+    if(argc < 2) {
+        run_stream(stdin);
+        return 0;
+    }
+    for(int i = 1; i < argc; ++i) {
+        std::FILE * in = std::fopen(argv[i], "rb");
+        if(in == nullptr) {
+            std::perror(argv[i]);
+            return 1;
+        }
+        run_stream(in);
+        std::fclose(in);
+    }
+    return 0;
+}
+#endif
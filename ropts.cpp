@@ -1,205 +1,785 @@
+// In header-only mode this file is included at the end of ropts.h, and compiling it is a no-op.
+#ifndef ROPTS_IMPLEMENTATION_GUARD
+#define ROPTS_IMPLEMENTATION_GUARD
+
 #include "ropts.h"
 
 /* Number to str conversions :
  * C++17 has to_chars/from_chars.
- * However they are not supported for floats on Linux (yet).
+ * However floats are only supported by recent standard libraries (__cpp_lib_to_chars).
  *
- * Parsing: use C strto<T> ; they require a null terminated string (copy) and use errno.
- * Writing: use snprintf with format specifier.
+ * Parsing: use from_chars, which works directly on string_view (no allocation, no errno).
+ * Base prefixes (0x, 0) and leading '+' are handled explicitly to match strto<T> behavior.
+ * Leading whitespace is rejected, unlike strto<T>, by from_chars and explicitly in the fallback.
+ * Floats fallback to C strto<T> if from_chars is not available for them.
+ * Writing: use to_chars to a stack buffer (snprintf fallback for floats).
  */
 
+#include <algorithm> // sort, lower_bound
+#include <atomic>    // parse_batch work distribution
+#include <cctype>    // isspace
+#include <charconv>  // from_chars, to_chars
 #include <cerrno>    // strto<T> error detection
-#include <cinttypes> // strtoimax
 #include <cstdio>    // FILE* based IO
 #include <cstdlib>   // strtoT for floating point
+#include <cstring>   // memcpy
+#include <exception> // exception_ptr
 #include <limits>
+#include <mutex>
 #include <ostream> // std::ostream IO
 #include <string>
+#include <thread> // parse_batch workers
+
+// Response files and config snapshots are mapped if possible, in header-only mode too.
+#if defined(__unix__) || defined(__APPLE__)
+#define ROPTS_HAS_MMAP 1
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#endif
+
+// Definitions are inline in header-only mode, file local helpers too (no per TU copies).
+// Helpers are in namespace detail : in header-only mode they are visible to user code.
+#ifdef ROPTS_HEADER_ONLY
+#define ROPTS_INLINE inline
+#define ROPTS_LOCAL inline
+#else
+#define ROPTS_INLINE
+#define ROPTS_LOCAL static
+#endif
 
 namespace ropts {
+#ifdef ROPTS_INSTRUMENTATION
+ROPTS_INLINE Instrumentation & instrumentation() noexcept {
+    static thread_local Instrumentation counters;
+    return counters;
+}
+
+namespace detail {
+// Adds the time spent in the current scope to a duration.
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(std::chrono::nanoseconds & duration) noexcept
+        : duration_(duration), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { duration_ += std::chrono::steady_clock::now() - start_; }
+
+  private:
+    std::chrono::nanoseconds & duration_;
+    std::chrono::steady_clock::time_point start_;
+};
+} // namespace detail
+#endif
+
 /******************************************************************************
- * Command line decomposition.
+ * Error reporting.
  */
-std::optional<string_view> CommandLine::next() {
-    if(current_element_) {
-        string_view current = *current_element_;
-        current_element_.reset();
-        return current;
-    } else if(next_argument_ < argc_) {
-        auto current = string_view{argv_[next_argument_]};
-        next_argument_ += 1;
-        return current;
-    } else {
-        return {};
-    }
+ROPTS_INLINE void throw_exception(std::string && message) {
+#if ROPTS_EXCEPTIONS
+    throw Exception(std::move(message));
+#else
+    std::fprintf(stderr, "ropts: %s\n", message.c_str());
+    std::abort();
+#endif
 }
 
-string_view CommandLine::next_value_or_fail(string_view value_name) {
-    std::optional<string_view> value = next();
-    if(value) {
-        return *value;
-    } else {
-        std::string buf;
+ROPTS_INLINE void fail_duplicate_name(string_view name) {
+    std::string message = "duplicate name in static table: '";
+    message.append(name.data(), name.size());
+    message += '\'';
+    throw_exception(std::move(message));
+}
+
+ROPTS_INLINE std::string ParseError::message() const {
+    // Errors from option parsing are prefixed by the option name
+    string_view const name_of_option = option != nullptr ? option->name() : option_name;
+    // Fixed parts are short : a single allocation, even with long texts (no growth copies).
+    std::string buf;
+    buf.reserve(
+        64 + name_of_option.size() + text.size() + name.size() + value_name.size() +
+        type_name.size() + other_message.size());
+    bool const option_prefix = !name_of_option.empty() && code != ErrorCode::RepeatedOption;
+    if(option_prefix) {
+        write_text(buf, "option '");
+        write_text(buf, name_of_option);
+        write_text(buf, "': ");
+    }
+    switch(code) {
+    case ErrorCode::None:
+        break;
+    case ErrorCode::UnknownOption:
+        write_text(buf, "unknown option name: '");
+        if(text.size() >= 2 && text[0] == '-' && text[1] == '-') {
+            write_text(buf, "--");
+            write_text(buf, name);
+        } else {
+            write_text(buf, '-');
+            write_text(buf, name);
+            if(text.size() > 2) {
+                write_text(buf, "' in '");
+                write_text(buf, text);
+            }
+        }
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::UnexpectedValue:
+        write_text(buf, "option does not take a value: '");
+        write_text(buf, text);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::MissingValue:
         write_text(buf, "missing value '");
         write_text(buf, value_name);
         write_text(buf, '\'');
-        throw Exception(std::move(buf));
+        break;
+    case ErrorCode::RepeatedOption:
+        write_text(buf, "option '");
+        write_text(buf, name_of_option);
+        write_text(buf, "' cannot be used more than once");
+        break;
+    case ErrorCode::InvalidValue:
+        write_text(buf, "value '");
+        write_text(buf, value_name);
+        write_text(buf, "' is not a valid ");
+        write_text(buf, type_name);
+        write_text(buf, ": '");
+        write_text(buf, text);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::UnexpectedPositional:
+        write_text(buf, "unexpected positional argument: '");
+        write_text(buf, text);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::ExclusiveOptions:
+        write_text(buf, "cannot be used with option '");
+        write_text(buf, name);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::MissingOption:
+        write_text(buf, "an option of group '");
+        write_text(buf, text);
+        write_text(buf, "' is required");
+        break;
+    case ErrorCode::Config:
+        write_text(buf, "invalid configuration: '");
+        write_text(buf, text);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::ResponseFile:
+        write_text(buf, "cannot read response file '");
+        write_text(buf, text);
+        write_text(buf, '\'');
+        break;
+    case ErrorCode::Other:
+        write_text(buf, other_message);
+        break;
+    }
+    return buf;
+}
+
+/******************************************************************************
+ * StringInterner.
+ */
+ROPTS_INLINE StringInterner::~StringInterner() {
+    std::pmr::memory_resource * resource = strings_.get_allocator().resource();
+    for(string_view s : strings_) {
+        resource->deallocate(const_cast<char *>(s.data()), s.size(), alignof(char));
     }
 }
 
-void CommandLine::push_front(string_view element) {
-    assert(!current_element_);
-    current_element_ = element;
+ROPTS_INLINE CowStr StringInterner::intern(string_view s) {
+    if(s.empty()) {
+        return {};
+    }
+    auto it = strings_.find(s);
+    if(it == strings_.end()) {
+        std::pmr::memory_resource * resource = strings_.get_allocator().resource();
+        char * buf = static_cast<char *>(resource->allocate(s.size(), alignof(char)));
+        std::char_traits<char>::copy(buf, s.data(), s.size());
+        string_view copy{buf, s.size()};
+#if ROPTS_EXCEPTIONS
+        try {
+            it = strings_.insert(copy).first;
+        } catch(...) {
+            resource->deallocate(buf, s.size(), alignof(char));
+            throw;
+        }
+#else
+        it = strings_.insert(copy).first;
+#endif
+    }
+    return CowStr::borrowed(*it);
 }
 
 /******************************************************************************
- * ValueTrait
+ * Command line decomposition.
  */
+namespace detail {
+ROPTS_LOCAL bool is_response_file_separator(char c) noexcept {
+    return c == '\n' || c == '\r' || c == '\0';
+}
+} // namespace detail
 
-[[noreturn]] static void
-fail_invalid_type_parsing(string_view text, string_view value_name, string_view type_name) {
-    std::string buf;
-    write_text(buf, "value '");
-    write_text(buf, value_name);
-    write_text(buf, "' is not a valid ");
-    write_text(buf, type_name);
-    write_text(buf, ": '");
-    write_text(buf, text);
-    write_text(buf, '\'');
-    throw Exception(std::move(buf));
+ROPTS_INLINE std::optional<string_view> CommandLine::next() {
+    ParseError error;
+    std::optional<string_view> element = next(error);
+    if(error) {
+        throw_exception(error.message());
+    }
+    return element;
 }
 
-static std::intmax_t parse_intmax(string_view text, string_view value_name, string_view type_name) {
-    if(!text.empty()) {
-        std::string null_terminated{text.data(), text.size()};
-        char * end_ptr = nullptr;
-        errno = 0;
-        std::intmax_t value = std::strtoimax(null_terminated.data(), &end_ptr, 0);
-        if(end_ptr == null_terminated.data() + null_terminated.size() && errno == 0) {
-            return value;
+ROPTS_INLINE std::optional<string_view> CommandLine::next(ParseError & error) {
+    ROPTS_INSTRUMENT(instrumentation().nb_next_calls += 1);
+    last_from_argv_ = false;
+    if(nb_pending_ > 0) {
+        nb_pending_ -= 1;
+        return pending_[nb_pending_];
+    }
+    while(true) {
+        if(!response_file_remaining_.empty()) {
+            string_view & text = response_file_remaining_;
+            std::size_t token_size = 0;
+            while(token_size < text.size() &&
+                  !detail::is_response_file_separator(text[token_size])) {
+                token_size += 1;
+            }
+            string_view token = text.substr(0, token_size);
+            std::size_t end = token_size;
+            while(end < text.size() && detail::is_response_file_separator(text[end])) {
+                end += 1;
+            }
+            text.remove_prefix(end);
+            if(!token.empty()) {
+                return token;
+            }
+        } else if(source_ != nullptr) {
+            std::optional<string_view> element = source_->next();
+            element_index_ += element ? 1 : 0;
+            return element;
+        } else if(next_argument_ < argc_) {
+            auto current = string_view{argv_[next_argument_]};
+            element_index_ = static_cast<std::size_t>(next_argument_);
+            next_argument_ += 1;
+            if(response_files_ != nullptr && current.size() > 1 && current[0] == '@') {
+                string_view path = current.substr(1);
+                if(!response_files_->try_load(path, response_file_remaining_)) {
+                    error.code = ErrorCode::ResponseFile;
+                    error.text = path;
+                    return {};
+                }
+            } else {
+                last_from_argv_ = true;
+                return current;
+            }
+        } else {
+            return {};
         }
     }
-    fail_invalid_type_parsing(text, value_name, type_name);
 }
 
-template <typename T>
-static T parse_signed_integer(string_view text, string_view value_name, string_view type_name) {
-    using Limits = std::numeric_limits<T>;
-    static_assert(Limits::is_integer, "implementation bug");
-    static_assert(Limits::is_signed, "implementation bug");
-    std::intmax_t value = parse_intmax(text, value_name, type_name);
-    if(std::intmax_t(Limits::min()) <= value && value <= std::intmax_t(Limits::max())) {
-        return static_cast<T>(value);
-    } else {
-        fail_invalid_type_parsing(text, value_name, type_name);
+ROPTS_INLINE bool CommandLine::take_remaining_argv(Slice<char const *> & elements) noexcept {
+    if(source_ != nullptr || response_files_ != nullptr || nb_pending_ > 0 ||
+       !response_file_remaining_.empty()) {
+        return false;
+    }
+    elements = {argv_ + next_argument_, static_cast<std::size_t>(argc_ - next_argument_)};
+    if(elements.size > 0) {
+        element_index_ = static_cast<std::size_t>(argc_ - 1);
+        last_from_argv_ = true;
+        next_argument_ = argc_;
     }
+    return true;
 }
 
-// Write a numeric value using snprintf
-template <typename T>
-static std::size_t write_numeric(std::string & buffer, T value, char const * format) {
-    std::size_t estimated_size =
-        std::numeric_limits<T>::is_integer
-            ? std::numeric_limits<T>::digits10 + 2  // Integers : max digits + space for '-'
-            : std::numeric_limits<T>::digits10 + 9; // Floats : max digits + '-0.' + 'e-300'
-    std::size_t init_buf_size = buffer.size();
+ROPTS_INLINE string_view CommandLine::next_value_or_fail(string_view value_name) {
+    string_view value;
+    ParseError error;
+    if(!next_value(value, value_name, error)) {
+        throw_exception(error.message());
+    }
+    return value;
+}
+
+ROPTS_INLINE bool
+CommandLine::next_value(string_view & value, string_view value_name, ParseError & error) {
+    std::optional<string_view> element = next(error);
+    if(element) {
+        value = *element;
+        return true;
+    }
+    if(!error) {
+        error.code = ErrorCode::MissingValue;
+        error.value_name = value_name;
+    }
+    return false;
+}
+
+ROPTS_INLINE void CommandLine::push_front(string_view element) {
+    assert(nb_pending_ < max_pending);
+    pending_[nb_pending_] = element;
+    nb_pending_ += 1;
+}
+
+/******************************************************************************
+ * Streaming source.
+ */
+ROPTS_INLINE StreamArgumentSource::StreamArgumentSource(
+    std::FILE * in, char separator, std::size_t chunk_size)
+    : in_(in), separator_(separator), buffer_(chunk_size > 0 ? chunk_size : 1) {
+    assert(in_ != nullptr);
+}
+
+ROPTS_INLINE std::optional<string_view> StreamArgumentSource::next() {
+    std::size_t searched = begin_; // Part of [begin_, end_) without separator
     while(true) {
-        // Try writing to the buffer + estimated_size bytes
-        buffer.resize(init_buf_size + estimated_size);
-        int written = std::snprintf(&buffer[init_buf_size], estimated_size, format, value);
-        if(written >= 0 && std::size_t(written) < estimated_size) {
-            // Trim the buffer to what was written (remove unwritten space)
-            auto written_size = static_cast<std::size_t>(written);
-            buffer.resize(init_buf_size + written_size);
-            return written_size;
-        } else {
-            // Try again with bigger space
-            estimated_size *= 2;
+        for(std::size_t i = searched; i < end_; ++i) {
+            if(buffer_[i] == separator_) {
+                string_view element{&buffer_[begin_], i - begin_};
+                begin_ = i + 1;
+                return element;
+            }
         }
+        if(end_of_stream_) {
+            if(begin_ < end_) {
+                // Last element without separator
+                string_view element{&buffer_[begin_], end_ - begin_};
+                begin_ = end_;
+                return element;
+            }
+            return {};
+        }
+        // Move the partial element to the front, grow if it fills the buffer, and read more.
+        std::char_traits<char>::move(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+        searched = end_;
+        if(end_ == buffer_.size()) {
+            buffer_.resize(2 * buffer_.size());
+        }
+        std::size_t read_size = std::fread(&buffer_[end_], 1, buffer_.size() - end_, in_);
+        end_ += read_size;
+        if(read_size == 0) {
+            end_of_stream_ = true;
+        }
+    }
+}
+
+/******************************************************************************
+ * Response files.
+ */
+ROPTS_INLINE ResponseFiles::~ResponseFiles() {
+    for(File const & file : files_) {
+#ifdef ROPTS_HAS_MMAP
+        if(file.mapped) {
+            munmap(const_cast<char *>(file.data), file.size);
+            continue;
+        }
+#endif
+        delete[] file.data;
     }
 }
 
-int ValueTrait<int>::parse(string_view text, string_view name) {
-    return parse_signed_integer<int>(text, name, "integer (int)");
+ROPTS_INLINE string_view ResponseFiles::load(string_view path) {
+    string_view content;
+    if(!try_load(path, content)) {
+        ParseError error;
+        error.code = ErrorCode::ResponseFile;
+        error.text = path;
+        throw_exception(error.message());
+    }
+    return content;
+}
+
+namespace detail {
+// Reads until the end of stream, to a new[] buffer : for streams without a known size.
+ROPTS_LOCAL bool read_to_end(std::FILE * in, char const *& data, std::size_t & size) {
+    std::string text;
+    char chunk[4096];
+    std::size_t read_size;
+    while((read_size = std::fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        text.append(chunk, read_size);
+    }
+    if(std::ferror(in) != 0) {
+        return false;
+    }
+    char * copy = new char[text.size()];
+    std::char_traits<char>::copy(copy, text.data(), text.size());
+    data = copy;
+    size = text.size();
+    return true;
 }
-int ValueTrait<int>::parse(CommandLine & state, string_view name) {
-    return parse(state.next_value_or_fail(name), name);
+} // namespace detail
+
+ROPTS_INLINE bool ResponseFiles::try_load(string_view path, string_view & content) {
+    for(File const & file : files_) {
+        if(file.path == path) {
+            content = string_view{file.data, file.size};
+            return true;
+        }
+    }
+    // The push_back below must not throw once the file is mapped or read
+    files_.reserve(files_.size() + 1);
+    File file{std::string(path), nullptr, 0, false};
+#ifdef ROPTS_HAS_MMAP
+    int fd = ::open(file.path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if(S_ISREG(info.st_mode) && info.st_size > 0) {
+        file.size = static_cast<std::size_t>(info.st_size);
+        void * data = ::mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        file.data = static_cast<char const *>(data);
+        file.mapped = true;
+    } else {
+        // Pipes, devices and procfs files report a zero size : read them. Empty files too.
+        std::FILE * f = ::fdopen(fd, "rb");
+        if(f == nullptr) {
+            ::close(fd);
+            return false;
+        }
+        bool ok = detail::read_to_end(f, file.data, file.size);
+        std::fclose(f);
+        if(!ok) {
+            return false;
+        }
+    }
+#else
+    std::FILE * f = std::fopen(file.path.c_str(), "rb");
+    if(f == nullptr) {
+        return false;
+    }
+    bool ok = detail::read_to_end(f, file.data, file.size);
+    std::fclose(f);
+    if(!ok) {
+        return false;
+    }
+#endif
+    files_.push_back(std::move(file));
+    content = string_view{files_.back().data, files_.back().size};
+    return true;
 }
-std::size_t ValueTrait<int>::write(std::string & buffer, int value) {
-    return write_numeric(buffer, value, "%i");
+
+/******************************************************************************
+ * ValueTrait
+ */
+
+namespace detail {
+ROPTS_LOCAL bool fail_invalid_value(
+    string_view text, string_view value_name, string_view type_name, ParseError & error) noexcept {
+    error.code = ErrorCode::InvalidValue;
+    error.text = text;
+    error.value_name = value_name;
+    error.type_name = type_name;
+    return false;
 }
 
-long ValueTrait<long>::parse(string_view text, string_view name) {
-    return parse_signed_integer<long>(text, name, "integer (long)");
+// Throwing parse functions of numeric traits, from try_parse.
+template <typename T> ROPTS_LOCAL T parse_or_throw(string_view text, string_view name) {
+    T value{};
+    ParseError error;
+    if(!ValueTrait<T>::try_parse(text, name, value, error)) {
+        throw_exception(error.message());
+    }
+    return value;
 }
-long ValueTrait<long>::parse(CommandLine & state, string_view name) {
-    return parse(state.next_value_or_fail(name), name);
+template <typename T> ROPTS_LOCAL T parse_or_throw(CommandLine & state, string_view name) {
+    T value{};
+    ParseError error;
+    if(!ValueTrait<T>::try_parse(state, name, value, error)) {
+        throw_exception(error.message());
+    }
+    return value;
 }
-std::size_t ValueTrait<long>::write(std::string & buffer, long value) {
-    return write_numeric(buffer, value, "%li");
+template <typename T>
+ROPTS_LOCAL bool
+try_parse_next(CommandLine & state, string_view name, T & value, ParseError & error) {
+    string_view text;
+    return state.next_value(text, name, error) &&
+           ValueTrait<T>::try_parse(text, name, value, error);
 }
 
-float ValueTrait<float>::parse(string_view text, string_view name) {
-    if(!text.empty()) {
-        std::string null_terminated{text.data(), text.size()};
-        char * end_ptr = nullptr;
-        errno = 0;
-        float value = std::strtof(null_terminated.data(), &end_ptr);
-        if(end_ptr == null_terminated.data() + null_terminated.size() && errno == 0) {
-            return value;
+// Remove the leading sign if present, returns true if negative.
+// A second sign is rejected by keeping the text empty, as from_chars accepts '-'.
+ROPTS_LOCAL bool remove_sign(string_view & text) noexcept {
+    bool negative = false;
+    if(!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        negative = text[0] == '-';
+        text.remove_prefix(1);
+        if(!text.empty() && (text[0] == '-' || text[0] == '+')) {
+            text = string_view();
         }
     }
-    fail_invalid_type_parsing(text, name, "float");
-}
-float ValueTrait<float>::parse(CommandLine & state, string_view name) {
-    return parse(state.next_value_or_fail(name), name);
+    return negative;
 }
-std::size_t ValueTrait<float>::write(std::string & buffer, float value) {
-    return write_numeric(buffer, double(value), "%g");
+ROPTS_LOCAL bool remove_hex_prefix(string_view & text) noexcept {
+    if(text.size() >= 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        text.remove_prefix(2);
+        return true;
+    } else {
+        return false;
+    }
 }
 
-double ValueTrait<double>::parse(string_view text, string_view name) {
-    if(!text.empty()) {
-        std::string null_terminated{text.data(), text.size()};
-        char * end_ptr = nullptr;
-        errno = 0;
-        double value = std::strtod(null_terminated.data(), &end_ptr);
-        if(end_ptr == null_terminated.data() + null_terminated.size() && errno == 0) {
-            return value;
+// Parses integers like strtoimax with base 0 : decimal, 0x hexadecimal, 0 octal.
+ROPTS_LOCAL bool parse_intmax(string_view text, std::intmax_t & value) noexcept {
+    string_view digits = text;
+    bool negative = remove_sign(digits);
+    int base = 10;
+    if(remove_hex_prefix(digits)) {
+        base = 16;
+    } else if(digits.size() >= 2 && digits[0] == '0') {
+        base = 8;
+        digits.remove_prefix(1);
+    }
+    if(!digits.empty()) {
+        // from_chars on unsigned type rejects any remaining sign
+        std::uintmax_t magnitude = 0;
+        char const * end = digits.data() + digits.size();
+        std::from_chars_result r = std::from_chars(digits.data(), end, magnitude, base);
+        if(r.ec == std::errc() && r.ptr == end) {
+            constexpr auto max =
+                static_cast<std::uintmax_t>(std::numeric_limits<std::intmax_t>::max());
+            if(!negative && magnitude <= max) {
+                value = static_cast<std::intmax_t>(magnitude);
+                return true;
+            } else if(negative && magnitude <= max) {
+                value = -static_cast<std::intmax_t>(magnitude);
+                return true;
+            } else if(negative && magnitude == max + 1) {
+                value = std::numeric_limits<std::intmax_t>::min();
+                return true;
+            }
         }
     }
-    fail_invalid_type_parsing(text, name, "double");
+    return false;
+}
+
+template <typename T> ROPTS_LOCAL bool parse_signed_integer(string_view text, T & value) noexcept {
+    using Limits = std::numeric_limits<T>;
+    static_assert(Limits::is_integer, "implementation bug");
+    static_assert(Limits::is_signed, "implementation bug");
+    std::intmax_t parsed = 0;
+    if(parse_intmax(text, parsed) && std::intmax_t(Limits::min()) <= parsed &&
+       parsed <= std::intmax_t(Limits::max())) {
+        value = static_cast<T>(parsed);
+        return true;
+    } else {
+        return false;
+    }
 }
-double ValueTrait<double>::parse(CommandLine & state, string_view name) {
-    return parse(state.next_value_or_fail(name), name);
+
+// Parse a floating point value like strto<T> (returns false on error).
+// strto_fallback is used if from_chars does not support floating point.
+template <typename T>
+ROPTS_LOCAL bool parse_floating_point(
+    string_view text, T & value, [[maybe_unused]] T (*strto_fallback)(char const *, char **)) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    string_view digits = text;
+    bool negative = remove_sign(digits);
+    std::chars_format format = std::chars_format::general;
+    if(remove_hex_prefix(digits)) {
+        format = std::chars_format::hex;
+        if(!digits.empty() && digits[0] == '-') {
+            return false; // Sign after prefix
+        }
+    }
+    if(digits.empty()) {
+        return false;
+    }
+    char const * end = digits.data() + digits.size();
+    std::from_chars_result r = std::from_chars(digits.data(), end, value, format);
+    if(r.ec == std::errc() && r.ptr == end) {
+        if(negative) {
+            value = -value;
+        }
+        return true;
+    }
+    return false;
+#else
+    // strto<T> requires a null terminated string : copy to the stack, heap for very long texts.
+    // It skips leading whitespace that from_chars rejects.
+    if(text.empty() || std::isspace(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    char stack_buffer[128];
+    std::string heap_buffer;
+    char const * null_terminated = stack_buffer;
+    if(text.size() < sizeof(stack_buffer)) {
+        std::memcpy(stack_buffer, text.data(), text.size());
+        stack_buffer[text.size()] = '\0';
+    } else {
+        heap_buffer.assign(text.data(), text.size());
+        null_terminated = heap_buffer.c_str();
+    }
+    char * end_ptr = nullptr;
+    errno = 0;
+    value = strto_fallback(null_terminated, &end_ptr);
+    return end_ptr == null_terminated + text.size() && errno == 0;
+#endif
 }
-std::size_t ValueTrait<double>::write(std::string & buffer, double value) {
-    return write_numeric(buffer, value, "%g");
+
+// Numeric text is formatted in a stack buffer, then appended once to the output buffer.
+// 64 chars is enough for any integer, shortest float representation, or %g output.
+ROPTS_LOCAL constexpr std::size_t numeric_buffer_size = 64;
+
+template <typename T> ROPTS_LOCAL std::size_t write_integer(std::string & buffer, T value) {
+    char chars[numeric_buffer_size];
+    std::to_chars_result r = std::to_chars(chars, chars + numeric_buffer_size, value);
+    assert(r.ec == std::errc());
+    return write_text(buffer, string_view(chars, static_cast<std::size_t>(r.ptr - chars)));
 }
 
-long double ValueTrait<long double>::parse(string_view text, string_view name) {
-    if(!text.empty()) {
-        std::string null_terminated{text.data(), text.size()};
-        char * end_ptr = nullptr;
-        errno = 0;
-        long double value = std::strtold(null_terminated.data(), &end_ptr);
-        if(end_ptr == null_terminated.data() + null_terminated.size() && errno == 0) {
-            return value;
+// Floats use the shortest representation that parses back to the same value.
+// Without to_chars support for floats, use snprintf with increasing precision until the text
+// parses back to the same value with strto<T> (usually at the first try).
+template <typename T>
+ROPTS_LOCAL std::size_t write_floating_point(
+    std::string & buffer, T value, [[maybe_unused]] T (*strto_fallback)(char const *, char **)) {
+    char chars[numeric_buffer_size];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::to_chars_result r = std::to_chars(chars, chars + numeric_buffer_size, value);
+    assert(r.ec == std::errc());
+    auto written_size = static_cast<std::size_t>(r.ptr - chars);
+#else
+    std::size_t written_size = 0;
+    for(int precision = std::numeric_limits<T>::digits10;
+        precision <= std::numeric_limits<T>::max_digits10;
+        ++precision) {
+        int written = std::snprintf(chars, numeric_buffer_size, "%.*g", precision, double(value));
+        assert(written >= 0 && std::size_t(written) < numeric_buffer_size);
+        written_size = static_cast<std::size_t>(written);
+        if(strto_fallback(chars, nullptr) == value) {
+            break;
         }
     }
-    fail_invalid_type_parsing(text, name, "long double");
+#endif
+    return write_text(buffer, string_view(chars, written_size));
+}
+} // namespace detail
+
+ROPTS_INLINE int ValueTrait<int>::parse(string_view text, string_view name) {
+    return detail::parse_or_throw<int>(text, name);
+}
+ROPTS_INLINE int ValueTrait<int>::parse(CommandLine & state, string_view name) {
+    return detail::parse_or_throw<int>(state, name);
+}
+ROPTS_INLINE bool ValueTrait<int>::try_parse(
+    string_view text, string_view name, int & value, ParseError & error) {
+    return detail::parse_signed_integer(text, value) ||
+           detail::fail_invalid_value(text, name, "integer (int)", error);
+}
+ROPTS_INLINE bool ValueTrait<int>::try_parse(
+    CommandLine & state, string_view name, int & value, ParseError & error) {
+    return detail::try_parse_next(state, name, value, error);
+}
+ROPTS_INLINE std::size_t ValueTrait<int>::write(std::string & buffer, int value) {
+    return detail::write_integer(buffer, value);
+}
+
+ROPTS_INLINE long ValueTrait<long>::parse(string_view text, string_view name) {
+    return detail::parse_or_throw<long>(text, name);
+}
+ROPTS_INLINE long ValueTrait<long>::parse(CommandLine & state, string_view name) {
+    return detail::parse_or_throw<long>(state, name);
+}
+ROPTS_INLINE bool ValueTrait<long>::try_parse(
+    string_view text, string_view name, long & value, ParseError & error) {
+    return detail::parse_signed_integer(text, value) ||
+           detail::fail_invalid_value(text, name, "integer (long)", error);
+}
+ROPTS_INLINE bool ValueTrait<long>::try_parse(
+    CommandLine & state, string_view name, long & value, ParseError & error) {
+    return detail::try_parse_next(state, name, value, error);
+}
+ROPTS_INLINE std::size_t ValueTrait<long>::write(std::string & buffer, long value) {
+    return detail::write_integer(buffer, value);
 }
-long double ValueTrait<long double>::parse(CommandLine & state, string_view name) {
-    return parse(state.next_value_or_fail(name), name);
+
+ROPTS_INLINE float ValueTrait<float>::parse(string_view text, string_view name) {
+    return detail::parse_or_throw<float>(text, name);
+}
+ROPTS_INLINE float ValueTrait<float>::parse(CommandLine & state, string_view name) {
+    return detail::parse_or_throw<float>(state, name);
+}
+ROPTS_INLINE bool ValueTrait<float>::try_parse(
+    string_view text, string_view name, float & value, ParseError & error) {
+    return detail::parse_floating_point(text, value, std::strtof) ||
+           detail::fail_invalid_value(text, name, "float", error);
+}
+ROPTS_INLINE bool ValueTrait<float>::try_parse(
+    CommandLine & state, string_view name, float & value, ParseError & error) {
+    return detail::try_parse_next(state, name, value, error);
 }
-std::size_t ValueTrait<long double>::write(std::string & buffer, long double value) {
-    return write_numeric(buffer, value, "%Lg");
+ROPTS_INLINE std::size_t ValueTrait<float>::write(std::string & buffer, float value) {
+    return detail::write_floating_point(buffer, value, std::strtof);
+}
+
+ROPTS_INLINE double ValueTrait<double>::parse(string_view text, string_view name) {
+    return detail::parse_or_throw<double>(text, name);
+}
+ROPTS_INLINE double ValueTrait<double>::parse(CommandLine & state, string_view name) {
+    return detail::parse_or_throw<double>(state, name);
+}
+ROPTS_INLINE bool ValueTrait<double>::try_parse(
+    string_view text, string_view name, double & value, ParseError & error) {
+    return detail::parse_floating_point(text, value, std::strtod) ||
+           detail::fail_invalid_value(text, name, "double", error);
+}
+ROPTS_INLINE bool ValueTrait<double>::try_parse(
+    CommandLine & state, string_view name, double & value, ParseError & error) {
+    return detail::try_parse_next(state, name, value, error);
+}
+ROPTS_INLINE std::size_t ValueTrait<double>::write(std::string & buffer, double value) {
+    return detail::write_floating_point(buffer, value, std::strtod);
+}
+
+ROPTS_INLINE long double ValueTrait<long double>::parse(string_view text, string_view name) {
+    return detail::parse_or_throw<long double>(text, name);
+}
+ROPTS_INLINE long double ValueTrait<long double>::parse(CommandLine & state, string_view name) {
+    return detail::parse_or_throw<long double>(state, name);
+}
+ROPTS_INLINE bool ValueTrait<long double>::try_parse(
+    string_view text, string_view name, long double & value, ParseError & error) {
+    return detail::parse_floating_point(text, value, std::strtold) ||
+           detail::fail_invalid_value(text, name, "long double", error);
+}
+ROPTS_INLINE bool ValueTrait<long double>::try_parse(
+    CommandLine & state, string_view name, long double & value, ParseError & error) {
+    return detail::try_parse_next(state, name, value, error);
+}
+ROPTS_INLINE std::size_t ValueTrait<long double>::write(std::string & buffer, long double value) {
+    // Shortest representation is not used : long double values are often converted from double
+    // literals, and would print with ~20 digits. Use the same output as %Lg instead.
+    char chars[detail::numeric_buffer_size];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::to_chars_result r = std::to_chars(
+        chars, chars + detail::numeric_buffer_size, value, std::chars_format::general, 6);
+    assert(r.ec == std::errc());
+    auto written_size = static_cast<std::size_t>(r.ptr - chars);
+#else
+    int written = std::snprintf(chars, detail::numeric_buffer_size, "%Lg", value);
+    assert(written >= 0 && std::size_t(written) < detail::numeric_buffer_size);
+    auto written_size = static_cast<std::size_t>(written);
+#endif
+    return write_text(buffer, string_view(chars, written_size));
 }
 
 /******************************************************************************
  * OptionBase
  */
-string_view OptionBase::name() const noexcept {
+ROPTS_INLINE string_view OptionBase::name() const noexcept {
     if(has_long_name()) {
         return long_name();
     } else {
@@ -208,123 +788,624 @@ string_view OptionBase::name() const noexcept {
     }
 }
 
-void OptionBase::fail_option_repeated() const {
-    std::string buf;
-    write_text(buf, "option '");
-    write_text(buf, name());
-    write_text(buf, "' cannot be used more than once");
-    throw Exception(std::move(buf));
+ROPTS_INLINE void OptionBase::parse(CommandLine & state) {
+    ParseError error;
+    if(!try_parse(state, error)) {
+        throw_exception(error.message());
+    }
 }
-void OptionBase::fail_parsing_error(string_view msg) const {
-    std::string buf;
-    write_text(buf, "option '");
-    write_text(buf, name());
-    write_text(buf, "': ");
-    write_text(buf, msg);
-    throw Exception(std::move(buf));
+ROPTS_INLINE void OptionBase::parse(CommandLine & state, OptionResultBase & result) const {
+    ParseError error;
+    if(!try_parse(state, result, error)) {
+        throw_exception(error.message());
+    }
+}
+
+ROPTS_INLINE bool OptionBase::record_value_elements(
+    CommandLine & state, std::pmr::vector<string_view> & elements, ParseError & error) const {
+    std::size_t const initial_size = elements.size();
+    for(CowStr const & value_name : value_names()) {
+        string_view element;
+        if(!state.next_value(element, value_name, error)) {
+            elements.resize(initial_size);
+            return false;
+        }
+        elements.push_back(element);
+    }
+    return true;
+}
+
+/******************************************************************************
+ * Positionals
+ */
+ROPTS_INLINE void Positionals::add(string_view element, char const * const * argv_element) {
+    if(elements_.empty() && argv_element != nullptr &&
+       (argv_.size == 0 || argv_element == argv_.end())) {
+        argv_ = {argv_.size == 0 ? argv_element : argv_.base, argv_.size + 1};
+        return;
+    }
+    if(argv_.size > 0) {
+        // Not consecutive anymore : switch to copies
+        elements_.reserve(argv_.size + 1);
+        for(char const * argv_element : argv_) {
+            elements_.emplace_back(argv_element);
+        }
+        argv_ = {};
+    }
+    elements_.push_back(element);
+}
+
+ROPTS_INLINE void Positionals::add(Slice<char const *> argv_elements) {
+    if(argv_elements.size == 0) {
+        return;
+    }
+    if(elements_.empty() && (argv_.size == 0 || argv_elements.base == argv_.end())) {
+        char const * const * base = argv_.size == 0 ? argv_elements.base : argv_.base;
+        argv_ = {base, argv_.size + argv_elements.size};
+        return;
+    }
+    for(char const * const & argv_element : argv_elements) {
+        add(string_view{argv_element}, &argv_element);
+    }
 }
 
 /******************************************************************************
  * Application
  */
-template <typename Predicate>
-static OptionBase * find(std::vector<OptionBase *> & options, Predicate predicate) {
-    for(OptionBase * option : options) {
-        if(predicate(option)) {
-            return option;
+namespace detail {
+// Names never contain '\0' : zero padding sorts shorter names first, as string_view does.
+ROPTS_LOCAL std::uint64_t name_prefix_key(string_view name) noexcept {
+    unsigned char bytes[8] = {};
+    std::memcpy(bytes, name.data(), std::min<std::size_t>(name.size(), 8));
+    std::uint64_t key = 0;
+    for(unsigned char byte : bytes) {
+        key = (key << 8) | byte;
+    }
+    return key;
+}
+
+// Three way comparison of (key, name) pairs, with name_prefix_key(name) == key.
+ROPTS_LOCAL int compare_long_names(
+    std::uint64_t lhs_key, string_view lhs, std::uint64_t rhs_key, string_view rhs) noexcept {
+    if(lhs_key != rhs_key) {
+        return lhs_key < rhs_key ? -1 : 1;
+    } else if(lhs.size() <= 8 || rhs.size() <= 8) {
+        // Equal prefixes, and one name ends within : sizes decide.
+        return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+    } else {
+        return lhs.substr(8).compare(rhs.substr(8));
+    }
+}
+} // namespace detail
+
+ROPTS_INLINE void Application::build_index() const {
+    short_name_index_.fill(no_option_index);
+    long_name_index_.clear();
+    ROPTS_INSTRUMENT(std::size_t capacity = long_name_index_.capacity());
+    long_name_index_.reserve(options_.size());
+    ROPTS_INSTRUMENT(instrumentation().count_growth(capacity, long_name_index_.capacity()));
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        OptionBase const & option = *options_[i];
+        auto option_index = static_cast<std::uint32_t>(i);
+        if(option.has_short_name()) {
+            std::uint32_t & slot =
+                short_name_index_[static_cast<unsigned char>(option.short_name())];
+            assert(slot == no_option_index); // Short names must be unique
+            slot = option_index;
+        }
+        if(option.has_long_name()) {
+            string_view name = option.long_name();
+            long_name_index_.push_back(
+                LongNameEntry{detail::name_prefix_key(name), name, option_index});
         }
     }
-    return nullptr;
+    address_index_.resize(options_.size());
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        address_index_[i] = static_cast<std::uint32_t>(i);
+    }
+    std::sort(
+        address_index_.begin(),
+        address_index_.end(),
+        [this](std::uint32_t lhs, std::uint32_t rhs) {
+            return std::less<OptionBase const *>{}(options_[lhs], options_[rhs]);
+        });
+    std::sort(
+        long_name_index_.begin(),
+        long_name_index_.end(),
+        [](LongNameEntry const & lhs, LongNameEntry const & rhs) {
+            return detail::compare_long_names(lhs.key, lhs.name, rhs.key, rhs.name) < 0;
+        });
+    assert(
+        std::adjacent_find(
+            long_name_index_.begin(),
+            long_name_index_.end(),
+            [](LongNameEntry const & lhs, LongNameEntry const & rhs) {
+                return lhs.name == rhs.name;
+            }) == long_name_index_.end()); // Long names must be unique
+    index_is_valid_ = true; // For option_index
+
+    occurrence_bits_.resize(nb_occurrence_words());
+    group_words_.clear();
+    group_ends_.clear();
+    group_ends_.reserve(groups_.size());
+    for(OptionGroup const * group : groups_) {
+        std::size_t const begin = group_words_.size();
+        for(OptionBase const * option : group->options) {
+            std::size_t index = option_index(*option);
+            auto word = static_cast<std::uint32_t>(index / 64);
+            group_words_.push_back(GroupWord{word, std::uint64_t(1) << (index % 64)});
+        }
+        // Merge masks of the same word
+        std::sort(
+            group_words_.begin() + begin,
+            group_words_.end(),
+            [](GroupWord const & lhs, GroupWord const & rhs) { return lhs.word < rhs.word; });
+        std::size_t end = begin;
+        for(std::size_t i = begin; i < group_words_.size(); ++i) {
+            if(end > begin && group_words_[end - 1].word == group_words_[i].word) {
+                group_words_[end - 1].mask |= group_words_[i].mask;
+            } else {
+                group_words_[end++] = group_words_[i];
+            }
+        }
+        group_words_.resize(end);
+        group_ends_.push_back(static_cast<std::uint32_t>(end));
+    }
 }
 
-void Application::parse(CommandLine command_line) {
-    bool enable_option_parsing = true; // Set to false if '--' is encountered.
+ROPTS_INLINE std::size_t Application::find_short(char name) const noexcept {
+    assert(index_is_valid_);
+    ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+    std::uint32_t option_index = short_name_index_[static_cast<unsigned char>(name)];
+    return option_index != no_option_index ? option_index : no_option;
+}
 
-    while(std::optional<string_view> maybe_element = command_line.next()) {
+ROPTS_INLINE std::size_t Application::find_long(string_view name) const noexcept {
+    assert(index_is_valid_);
+    ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+    std::uint64_t const key = detail::name_prefix_key(name);
+    auto it = std::lower_bound(
+        long_name_index_.begin(),
+        long_name_index_.end(),
+        name,
+        [key](LongNameEntry const & entry, string_view name) {
+            return detail::compare_long_names(entry.key, entry.name, key, name) < 0;
+        });
+    if(it != long_name_index_.end() &&
+       detail::compare_long_names(it->key, it->name, key, name) == 0) {
+        return it->option;
+    } else {
+        return no_option;
+    }
+}
+
+// Counts are upper bounds : values are not skipped, and could be mistaken for options.
+// This is harmless as they are only used to reserve storage.
+ROPTS_INLINE void Application::prescan(CommandLine command_line) {
+    ROPTS_INSTRUMENT(std::size_t capacity = prescan_counts_.capacity());
+    prescan_counts_.assign(options_.size(), 0);
+    ROPTS_INSTRUMENT(instrumentation().count_growth(capacity, prescan_counts_.capacity()));
+    ParseError ignored; // Errors are reported by the parsing pass
+    while(std::optional<string_view> maybe_element = command_line.next(ignored)) {
         string_view element = *maybe_element;
-        if(enable_option_parsing && element.size() >= 2 && element[0] == '-' && element[1] == '-') {
-            // Long option
-            string_view option_name = string_view{&element[2], element.size() - 2};
-            if(option_name.empty()) {
-                // '--'
-                enable_option_parsing = false;
-            } else {
-                // '--name'
-                // TODO support '--name=blah' mode
-                OptionBase * option = find(options_, [option_name](OptionBase * o) {
-                    return o->long_name() == option_name;
-                });
-                if(option != nullptr) {
-                    option->parse(command_line);
-                } else {
-                    std::string buf;
-                    write_text(buf, "unknown option name: '");
-                    write_text(buf, element);
-                    write_text(buf, '\'');
-                    throw Exception(std::move(buf));
+        std::size_t option = no_option;
+        if(element == "--") {
+            break;
+        } else if(element.size() > 2 && element[0] == '-' && element[1] == '-') {
+            option = find_long(element.substr(2, element.find('=') - 2));
+        } else if(element.size() >= 2 && element[0] == '-') {
+            // Packed options, up to the first one taking the rest of the element as value
+            for(std::size_t i = 1; i < element.size(); ++i) {
+                std::size_t packed = find_short(element[i]);
+                if(packed == no_option) {
+                    break;
+                }
+                prescan_counts_[packed] += 1;
+                if(takes_value(packed)) {
+                    break;
                 }
             }
-        } else if(enable_option_parsing && element.size() >= 2 && element[0] == '-') {
-            // Short option
-            if(element.size() > 2) {
-                std::string buf;
-                write_text(buf, "packed short options are not supported: '");
-                write_text(buf, element);
-                write_text(buf, '\'');
-                throw Exception(std::move(buf));
+        }
+        if(option != no_option) {
+            prescan_counts_[option] += 1;
+        }
+    }
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        if(prescan_counts_[i] > 0) {
+            options_[i]->reserve_occurrences(prescan_counts_[i]);
+        }
+    }
+}
+
+ROPTS_INLINE void Application::parse(CommandLine command_line) {
+    ParseError error;
+    if(!try_parse(command_line, error)) {
+        throw_exception(error.message());
+    }
+}
+
+ROPTS_INLINE bool Application::try_parse(CommandLine command_line, ParseError & error) {
+    if(!index_is_valid_) { // Not ensure_index(), to instrument the index build only
+        ROPTS_INSTRUMENT(detail::ScopedTimer timer{instrumentation().index_duration});
+        build_index();
+    }
+    if(prescan_ && command_line.is_restartable()) {
+        ROPTS_INSTRUMENT(detail::ScopedTimer timer{instrumentation().prescan_duration});
+        prescan(command_line);
+    }
+    ROPTS_INSTRUMENT(detail::ScopedTimer timer{instrumentation().parse_duration});
+    return try_parse_remaining(command_line, error);
+}
+
+ROPTS_INLINE bool Application::try_parse_remaining(CommandLine & command_line, ParseError & error) {
+    ensure_index();
+    selected_subcommand_ = nullptr;
+    if(positionals_ != nullptr) {
+        positionals_->clear();
+    }
+    std::fill(occurrence_bits_.begin(), occurrence_bits_.end(), 0);
+    return try_parse_options(*this, command_line, error) &&
+           (defer_group_checks_ || check_groups(occurrence_bits_.data(), error));
+}
+
+ROPTS_INLINE bool
+Application::check_groups(std::uint64_t const * occurrence_bits, ParseError & error) const {
+    std::size_t begin = 0;
+    for(std::size_t group = 0; group < groups_.size(); ++group) {
+        OptionGroup::Constraint const constraint = groups_[group]->constraint;
+        std::size_t const end = group_ends_[group];
+        bool found = false;
+        bool several = false;
+        for(std::size_t i = begin; i < end; ++i) {
+            std::uint64_t occurred = occurrence_bits[group_words_[i].word] & group_words_[i].mask;
+            several = several || (occurred != 0 && (found || (occurred & (occurred - 1)) != 0));
+            found = found || occurred != 0;
+        }
+        begin = end;
+        if(constraint == OptionGroup::Constraint::None) {
+            continue;
+        }
+        if(several) {
+            // Error path : find the first two options which occurred
+            OptionBase const * first = nullptr;
+            for(OptionBase const * option : groups_[group]->options) {
+                std::size_t index = option_index(*option);
+                if((occurrence_bits[index / 64] >> (index % 64)) & 1) {
+                    if(first == nullptr) {
+                        first = option;
+                    } else {
+                        error.code = ErrorCode::ExclusiveOptions;
+                        error.option = first;
+                        error.name = option->name();
+                        return false;
+                    }
+                }
             }
-            // '-c'
-            char option_name = element[1];
-            OptionBase * option = find(options_, [option_name](OptionBase * o) {
-                return o->short_name() == option_name; //
-            });
-            if(option != nullptr) {
-                option->parse(command_line);
-            } else {
-                std::string buf;
-                write_text(buf, "unknown option name: '");
-                write_text(buf, element);
-                write_text(buf, '\'');
-                throw Exception(std::move(buf));
+        }
+        if(!found && constraint == OptionGroup::Constraint::RequiredAndMutuallyExclusive) {
+            error.code = ErrorCode::MissingOption;
+            error.text = groups_[group]->name;
+            return false;
+        }
+    }
+    return true;
+}
+
+ROPTS_INLINE void
+Application::add_subcommand(CowStr name, std::function<void(Application &)> setup) {
+    assert(!name.empty());
+    assert(subcommand_index_.count(name) == 0); // Subcommand names must be unique
+    subcommands_.push_back(Subcommand{std::move(name), std::move(setup), nullptr});
+    Subcommand & subcommand = subcommands_.back();
+    subcommand_index_.emplace(subcommand.name.view(), &subcommand);
+    invalidate_usage();
+}
+
+namespace detail {
+// Elements after '--' are taken as one argv slice if possible.
+ROPTS_LOCAL bool store_positional(
+    Positionals * positionals,
+    string_view element,
+    bool after_separator,
+    CommandLine & state,
+    ParseError & error) {
+    if(positionals == nullptr) {
+        return fail_unexpected_positional(element, error);
+    }
+    positionals->add(element, state.last_argv_element());
+    Slice<char const *> remaining;
+    if(after_separator && state.take_remaining_argv(remaining)) {
+        positionals->add(remaining);
+    }
+    return true;
+}
+} // namespace detail
+
+ROPTS_INLINE bool Application::parse_positional(
+    string_view element, bool after_separator, CommandLine & state, ParseError & error) {
+    // Subcommand names are only recognized before other positionals
+    if(!after_separator && (positionals_ == nullptr || positionals_->empty())) {
+        auto it = subcommand_index_.find(element);
+        if(it != subcommand_index_.end()) {
+            Subcommand & subcommand = *it->second;
+            if(subcommand.application == nullptr) {
+                std::string name{name_.view()};
+                name += ' ';
+                name.append(subcommand.name.data(), subcommand.name.size());
+                subcommand.application = std::make_unique<Application>(CowStr(name), resource());
+                subcommand.setup(*subcommand.application);
+            }
+            selected_subcommand_ = subcommand.application.get();
+            return selected_subcommand_->try_parse_remaining(state, error);
+        }
+    }
+    return detail::store_positional(positionals_, element, after_separator, state, error);
+}
+
+ROPTS_INLINE std::size_t Application::option_index(OptionBase const & option) const noexcept {
+    assert(index_is_valid_);
+    auto it = std::lower_bound(
+        address_index_.begin(),
+        address_index_.end(),
+        &option,
+        [this](std::uint32_t index, OptionBase const * option) {
+            return std::less<OptionBase const *>{}(options_[index], option);
+        });
+    assert(it != address_index_.end() && options_[*it] == &option); // Must be registered
+    return *it;
+}
+
+ROPTS_INLINE OptionResultBase const & ParseResults::result(OptionBase const & option) const {
+    return *results_[application_->option_index(option)];
+}
+
+ROPTS_INLINE ParseResults Application::make_results() const {
+    ensure_index();
+    ParseResults results{*this, resource()};
+    results.results_.reserve(options_.size());
+    for(OptionBase const * option : options_) {
+        results.results_.push_back(option->make_result());
+    }
+    results.occurrence_bits_.resize(nb_occurrence_words());
+    return results;
+}
+
+ROPTS_INLINE void Application::parse(CommandLine command_line, ParseResults & results) const {
+    ParseError error;
+    if(!try_parse(command_line, results, error)) {
+        throw_exception(error.message());
+    }
+}
+
+ROPTS_INLINE bool Application::try_parse(
+    CommandLine command_line, ParseResults & results, ParseError & error) const {
+    assert(index_is_valid_);
+    assert(results.application_ == this && results.results_.size() == options_.size());
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        options_[i]->reset(*results.results_[i]);
+    }
+    results.positionals_.clear();
+    std::fill(results.occurrence_bits_.begin(), results.occurrence_bits_.end(), 0);
+    ResultsRegistry registry{*this, results};
+    return try_parse_options(registry, command_line, error) &&
+           check_groups(results.occurrence_bits_.data(), error);
+}
+
+ROPTS_INLINE bool Application::ResultsRegistry::parse_positional(
+    string_view element, bool after_separator, CommandLine & state, ParseError & error) {
+    if(!after_separator && application.subcommand_index_.count(element) > 0 &&
+       results.positionals_.empty()) {
+        error.code = ErrorCode::Other;
+        error.text = element;
+        error.other_message = "subcommand '";
+        error.other_message.append(element.data(), element.size());
+        error.other_message += "' is not supported by const parsing";
+        return false;
+    }
+    Positionals * positionals =
+        application.positionals_ != nullptr ? &results.positionals_ : nullptr;
+    return detail::store_positional(positionals, element, after_separator, state, error);
+}
+
+ROPTS_INLINE void Application::parse_batch(
+    Slice<CommandLine> command_lines, BatchCallback const & on_parsed, unsigned nb_threads) const {
+    // Lazy state of const methods, before starting threads : on_parsed may use them
+    ensure_index();
+    usage();
+    // Workers take command lines by chunks, to limit contention on the counter.
+    constexpr std::size_t chunk_size = 16;
+    std::size_t const nb_chunks = (command_lines.size + chunk_size - 1) / chunk_size;
+    if(nb_threads == 0) {
+        nb_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    nb_threads = static_cast<unsigned>(std::min<std::size_t>(nb_threads, nb_chunks));
+
+    std::atomic<std::size_t> next_chunk{0};
+    std::atomic<bool> stop{false};
+
+    auto parse_chunks = [&] {
+        ParseResults results = make_results();
+        while(!stop.load(std::memory_order_relaxed)) {
+            std::size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if(chunk >= nb_chunks) {
+                break;
+            }
+            std::size_t end = std::min((chunk + 1) * chunk_size, command_lines.size);
+            for(std::size_t i = chunk * chunk_size; i < end; ++i) {
+                ParseError error;
+                bool ok = try_parse(command_lines[i], results, error);
+                on_parsed(i, results, ok ? nullptr : &error);
             }
-        } else {
-            // TODO
-            // Subcommand
-            // Positional
-            // Or error
+        }
+    };
+#if ROPTS_EXCEPTIONS
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+    auto worker = [&] {
+        try {
+            parse_chunks();
+        } catch(...) {
+            std::lock_guard<std::mutex> lock{failure_mutex};
+            if(!failure) {
+                failure = std::current_exception();
+            }
+            stop = true;
+        }
+    };
+#else
+    auto & worker = parse_chunks;
+#endif
+
+    if(nb_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(nb_threads - 1);
+        for(unsigned i = 1; i < nb_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker(); // Calling thread is a worker too
+        for(std::thread & thread : threads) {
+            thread.join();
         }
     }
+#if ROPTS_EXCEPTIONS
+    if(failure) {
+        std::rethrow_exception(failure);
+    }
+#endif
 }
 
-// Output "independence" wrappers : write buffer to output and clear.
-// string::clear() should not reallocate in most cases.
-static void flush_buffer(std::FILE * out, std::string & buffer) {
+namespace detail {
+[[noreturn]] ROPTS_LOCAL void fail_unknown_option(string_view element, string_view name) {
+    ParseError error;
+    error.code = ErrorCode::UnknownOption;
+    error.text = element;
+    error.name = name;
+    throw_exception(error.message());
+}
+
+[[noreturn]] ROPTS_LOCAL void fail_partially_forwarded(string_view element) {
+    std::string buf;
+    write_text(buf, "cannot forward a subset of packed options: '");
+    write_text(buf, element);
+    write_text(buf, '\'');
+    throw_exception(std::move(buf));
+}
+} // namespace detail
+
+ROPTS_INLINE std::vector<char const *> Application::forward(
+    int argc, char const * const * argv, Slice<OptionBase const *> selected) const {
+    ensure_index();
+    std::vector<bool> is_selected(options_.size(), false);
+    for(OptionBase const * option : selected) {
+        is_selected[option_index(*option)] = true; // O(log n) with the address index
+    }
+
+    std::vector<char const *> forwarded;
+    int next_argument = 1;
+    while(next_argument < argc) {
+        char const * const element_pointer = argv[next_argument];
+        string_view element = element_pointer;
+        next_argument += 1;
+        bool forward_element = false;
+        std::size_t nb_values = 0; // Following elements used as values
+        if(element == "--") {
+            break;
+        } else if(element.size() > 2 && element[0] == '-' && element[1] == '-') {
+            std::size_t equal = element.find('=');
+            string_view name = element.substr(2, equal - 2);
+            std::size_t option = find_long(name);
+            if(option == no_option) {
+                detail::fail_unknown_option(element, name);
+            }
+            nb_values = options_[option]->value_names().size;
+            if(equal != string_view::npos && nb_values > 0) {
+                nb_values -= 1;
+            }
+            forward_element = is_selected[option];
+        } else if(element.size() >= 2 && element[0] == '-') {
+            std::size_t nb_options = 0;
+            std::size_t nb_selected = 0;
+            for(std::size_t i = 1; i < element.size(); ++i) {
+                std::size_t option = find_short(element[i]);
+                if(option == no_option) {
+                    detail::fail_unknown_option(element, element.substr(i, 1));
+                }
+                nb_options += 1;
+                nb_selected += is_selected[option] ? 1 : 0;
+                if(takes_value(option)) {
+                    nb_values = options_[option]->value_names().size;
+                    if(i + 1 < element.size()) {
+                        nb_values -= 1; // Rest of element is the first value
+                    }
+                    break;
+                }
+            }
+            if(nb_selected != 0 && nb_selected != nb_options) {
+                detail::fail_partially_forwarded(element);
+            }
+            forward_element = nb_selected > 0;
+        }
+        nb_values = std::min(nb_values, static_cast<std::size_t>(argc - next_argument));
+        if(forward_element) {
+            forwarded.push_back(element_pointer);
+            forwarded.insert(
+                forwarded.end(), argv + next_argument, argv + next_argument + nb_values);
+        }
+        next_argument += static_cast<int>(nb_values);
+    }
+    return forwarded;
+}
+
+namespace detail {
+// Output "independence" wrappers : write buffer to output (single write call).
+ROPTS_LOCAL void write_buffer(std::FILE * out, string_view buffer) {
     std::fwrite(buffer.data(), 1, buffer.size(), out);
-    buffer.clear();
 }
-static void flush_buffer(std::ostream & out, std::string & buffer) {
-    out.write(buffer.data(), buffer.size());
-    buffer.clear();
+ROPTS_LOCAL void write_buffer(std::ostream & out, string_view buffer) {
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
 }
 
+// Overloads for std::string, hidden by the ones below otherwise
+using ropts::write_text;
+
 // Dummy buffer to count size
 struct DummyBuffer {};
-static std::size_t write_text(DummyBuffer, string_view sv) {
+ROPTS_LOCAL std::size_t write_text(DummyBuffer, string_view sv) {
     return sv.size();
 }
-static std::size_t write_text(DummyBuffer, char) {
+ROPTS_LOCAL std::size_t write_text(DummyBuffer, char) {
     return 1;
 }
 
-template <typename Output>
-static void write_usage_impl(
-    Output && output, string_view application_name, std::vector<OptionBase *> const & options) {
-    std::string buffer;
+// Usage cache of an Application, allocated from its resource
+ROPTS_LOCAL std::size_t write_text(std::pmr::string & buffer, string_view s) {
+    buffer.append(s.data(), s.size());
+    return s.size();
+}
+ROPTS_LOCAL std::size_t write_text(std::pmr::string & buffer, char c) {
+    buffer.push_back(c);
+    return 1;
+}
+
+// Render the whole usage text to buffer.
+template <typename Buffer>
+ROPTS_LOCAL void render_usage(
+    Buffer & buffer,
+    string_view application_name,
+    Slice<OptionBase const *> options,
+    Positionals const * positionals = nullptr) {
     // Header
     {
         write_text(buffer, application_name);
-        write_text(buffer, " [options]\n\n");
-        flush_buffer(output, buffer);
+        write_text(buffer, " [options]");
+        if(positionals != nullptr) {
+            write_text(buffer, ' ');
+            write_text(buffer, positionals->value_name);
+            write_text(buffer, "...");
+        }
+        write_text(buffer, "\n\n");
     }
     // Option printing
     {
@@ -351,12 +1432,11 @@ static void write_usage_impl(
         // Compute max size of an option text up to help_text for alignement.
         std::size_t help_text_offset = 0;
         for(const OptionBase * option : options) {
-            std::size_t option_pattern_len = write_option_pattern(DummyBuffer{}, *option);
+            std::size_t option_pattern_len = write_option_pattern(detail::DummyBuffer{}, *option);
             help_text_offset = std::max(help_text_offset, option_pattern_len + 3);
         }
         // Printing
         write_text(buffer, "Options:\n");
-        flush_buffer(output, buffer);
         for(const OptionBase * option : options) {
             std::size_t size = write_option_pattern(buffer, *option);
             while(size < help_text_offset) {
@@ -364,16 +1444,676 @@ static void write_usage_impl(
             }
             write_text(buffer, option->help_text); // TODO line wrapping. Use terminal size ?
             write_text(buffer, '\n');
-            flush_buffer(output, buffer);
         }
     }
 }
 
-void Application::write_usage(std::FILE * out) const {
-    write_usage_impl(out, string_view(name_), options_);
+template <typename Output>
+ROPTS_LOCAL void write_usage_impl(
+    Output && output, string_view application_name, Slice<OptionBase const *> options) {
+    std::string buffer;
+    render_usage(buffer, application_name, options);
+    write_buffer(output, buffer);
+}
+} // namespace detail
+
+ROPTS_INLINE void
+write_usage(std::FILE * out, string_view application_name, Slice<OptionBase const *> options) {
+    detail::write_usage_impl(out, application_name, options);
+}
+ROPTS_INLINE void write_usage(
+    std::ostream & out, string_view application_name, Slice<OptionBase const *> options) {
+    detail::write_usage_impl(out, application_name, options);
+}
+
+ROPTS_INLINE string_view Application::usage() const {
+    if(usage_cache_.empty()) {
+        detail::render_usage(
+            usage_cache_, string_view(name_), {options_.data(), options_.size()}, positionals_);
+        if(!subcommands_.empty()) {
+            detail::write_text(usage_cache_, "\nSubcommands:\n");
+            for(Subcommand const & subcommand : subcommands_) {
+                detail::write_text(usage_cache_, "  ");
+                detail::write_text(usage_cache_, subcommand.name);
+                detail::write_text(usage_cache_, '\n');
+            }
+        }
+    }
+    return usage_cache_;
+}
+ROPTS_INLINE void Application::write_usage(std::FILE * out) const {
+    detail::write_buffer(out, usage());
+}
+ROPTS_INLINE void Application::write_usage(std::ostream & out) const {
+    detail::write_buffer(out, usage());
+}
+
+ROPTS_INLINE std::vector<Application::Completion> Application::complete(string_view partial) const {
+    ensure_index();
+    std::vector<Completion> completions;
+    if(partial.empty() || partial == "-") {
+        for(LongNameEntry const & entry : long_name_index_) {
+            completions.push_back(Completion{options_[entry.option], "--", entry.name});
+        }
+        for(std::uint32_t option_index : short_name_index_) {
+            OptionBase const * option =
+                option_index != no_option_index ? options_[option_index] : nullptr;
+            if(option != nullptr && !option->has_long_name()) {
+                completions.push_back(Completion{option, "-", option->name()});
+            }
+        }
+    } else if(partial.size() >= 2 && partial[0] == '-' && partial[1] == '-') {
+        // Long names with prefix are a contiguous range of the sorted index
+        string_view prefix = partial.substr(2);
+        auto it = std::lower_bound(
+            long_name_index_.begin(),
+            long_name_index_.end(),
+            prefix,
+            [](LongNameEntry const & entry, string_view prefix) { return entry.name < prefix; });
+        for(; it != long_name_index_.end() && it->name.substr(0, prefix.size()) == prefix; ++it) {
+            completions.push_back(Completion{options_[it->option], "--", it->name});
+        }
+    } else if(partial.size() == 2 && partial[0] == '-') {
+        std::uint32_t option_index = short_name_index_[static_cast<unsigned char>(partial[1])];
+        if(option_index != no_option_index) {
+            OptionBase const * option = options_[option_index];
+            completions.push_back(Completion{option, "-", partial.substr(1)});
+        }
+    }
+    return completions;
+}
+
+namespace detail {
+template <typename Output>
+ROPTS_LOCAL void write_completions_impl(
+    Output & output, std::vector<Application::Completion> const & completions) {
+    std::string buffer;
+    for(Application::Completion const & completion : completions) {
+        write_text(buffer, completion.dashes);
+        write_text(buffer, completion.name);
+        write_text(buffer, '\n');
+    }
+    write_buffer(output, buffer);
+}
+} // namespace detail
+ROPTS_INLINE void Application::write_completions(std::FILE * out, string_view partial) const {
+    detail::write_completions_impl(out, complete(partial));
+}
+ROPTS_INLINE void Application::write_completions(std::ostream & out, string_view partial) const {
+    detail::write_completions_impl(out, complete(partial));
+}
+
+/******************************************************************************
+ * Fallback values : environment and ConfigValues.
+ *
+ * ConfigValues binary form, also the snapshot file format (native endianness) :
+ * - header : magic (8 bytes), schema hash (u64), nb_entries (u32), nb_elements (u32).
+ * - entries : {option index (u32), number of elements (u32)} * nb_entries.
+ * - elements : {offset in texts (u32), size (u32)} * nb_elements, in entry order.
+ * - texts : element texts, concatenated.
+ */
+namespace detail {
+ROPTS_LOCAL constexpr char config_magic[8] = {'r', 'o', 'p', 't', 's', 'c', 'f', '1'};
+ROPTS_LOCAL constexpr std::size_t config_header_size = 24;
+ROPTS_LOCAL constexpr std::size_t config_record_size = 8; // Entries and elements
+
+ROPTS_LOCAL void append_u32(std::string & data, std::uint32_t value) {
+    data.append(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+ROPTS_LOCAL void append_u64(std::string & data, std::uint64_t value) {
+    data.append(reinterpret_cast<char const *>(&value), sizeof(value));
 }
-void Application::write_usage(std::ostream & out) const {
-    write_usage_impl(out, string_view(name_), options_);
+ROPTS_LOCAL std::uint32_t read_u32(string_view data, std::size_t offset) noexcept {
+    std::uint32_t value;
+    std::memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
 }
+ROPTS_LOCAL std::uint64_t read_u64(string_view data, std::size_t offset) noexcept {
+    std::uint64_t value;
+    std::memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+ROPTS_LOCAL bool is_config_space(char c) noexcept {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+ROPTS_LOCAL string_view trim_config_spaces(string_view text) noexcept {
+    while(!text.empty() && is_config_space(text.front())) {
+        text.remove_prefix(1);
+    }
+    while(!text.empty() && is_config_space(text.back())) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Elements of a text, separated by spaces
+class SplitArgumentSource final : public ArgumentSource {
+  public:
+    explicit SplitArgumentSource(string_view text) noexcept : text_(text) {}
+    std::optional<string_view> next() override {
+        text_ = trim_config_spaces(text_);
+        if(text_.empty()) {
+            return {};
+        }
+        std::size_t size = 0;
+        while(size < text_.size() && !is_config_space(text_[size])) {
+            size += 1;
+        }
+        string_view element = text_.substr(0, size);
+        text_.remove_prefix(size);
+        return element;
+    }
+
+  private:
+    string_view text_;
+};
+
+// Elements of one entry of a ConfigValues binary form
+class ConfigElementSource final : public ArgumentSource {
+  public:
+    ConfigElementSource(
+        string_view data, std::size_t element_offset, std::uint32_t nb_elements, std::size_t texts)
+        : data_(data), element_offset_(element_offset), nb_elements_(nb_elements), texts_(texts) {}
+    std::optional<string_view> next() override {
+        if(nb_elements_ == 0) {
+            return {};
+        }
+        std::uint32_t offset = read_u32(data_, element_offset_);
+        std::uint32_t size = read_u32(data_, element_offset_ + 4);
+        element_offset_ += config_record_size;
+        nb_elements_ -= 1;
+        return data_.substr(texts_ + offset, size);
+    }
+
+  private:
+    string_view data_;
+    std::size_t element_offset_;
+    std::uint32_t nb_elements_;
+    std::size_t texts_;
+};
+
+ROPTS_LOCAL bool fail_config(string_view text, ParseError & error) noexcept {
+    error.code = ErrorCode::Config;
+    error.text = text;
+    return false;
+}
+
+// Parse one occurrence of option from elements. text is the origin of elements, for errors.
+ROPTS_LOCAL bool apply_fallback(
+    OptionBase & option, ArgumentSource & elements, string_view text, ParseError & error) {
+    CommandLine command_line{elements};
+    if(option.value_names().size == 0) {
+        std::optional<string_view> value = command_line.next(error);
+        if(value && (*value == "0" || *value == "false")) {
+            return true;
+        }
+    }
+    if(!option.try_parse(command_line, error)) {
+        return false;
+    }
+    if(command_line.next(error)) {
+        error.option = &option;
+        return fail_config(text, error); // Too many elements
+    }
+    return true;
+}
+} // namespace detail
+
+ROPTS_INLINE std::uint64_t Application::schema_hash() const noexcept {
+    // FNV-1a
+    std::uint64_t hash = 14695981039346656037u;
+    auto mix = [&hash](char c) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211u;
+    };
+    for(OptionBase const * option : options_) {
+        mix(option->short_name());
+        for(char c : option->long_name()) {
+            mix(c);
+        }
+        mix('\0');
+        mix(static_cast<char>(option->value_names().size));
+    }
+    return hash;
+}
+
+ROPTS_INLINE void Application::apply_fallbacks(ConfigValues const * config) {
+    ParseError error;
+    if(!try_apply_fallbacks(config, error)) {
+        throw_exception(error.message());
+    }
+}
+
+ROPTS_INLINE bool
+Application::try_apply_fallbacks(ConfigValues const * config, ParseError & error) {
+    error = ParseError{};
+    ensure_index();
+    std::vector<bool> skip(options_.size()); // Options with a value, from higher priority sources
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        skip[i] = options_[i]->nb_occurrences() > 0;
+    }
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        OptionBase & option = *options_[i];
+        if(skip[i] || option.env_name.empty()) {
+            continue;
+        }
+        std::string const env_name{option.env_name.view()}; // Null terminated
+        char const * value = std::getenv(env_name.c_str());
+        if(value == nullptr || *value == '\0') {
+            continue;
+        }
+        detail::SplitArgumentSource elements{value};
+        if(!detail::apply_fallback(option, elements, value, error)) {
+            return false;
+        }
+        skip[i] = true;
+    }
+    if(config != nullptr && !config->try_apply(*this, skip, error)) {
+        return false;
+    }
+    // Fallback values are occurrences for group constraints
+    for(std::size_t i = 0; i < options_.size(); ++i) {
+        if(options_[i]->nb_occurrences() > 0) {
+            set_occurrence(occurrence_bits_.data(), i);
+        }
+    }
+    return check_groups(occurrence_bits_.data(), error);
+}
+
+ROPTS_INLINE bool ConfigValues::try_load_text(
+    Application const & application, string_view text, ParseError & error) {
+    application.ensure_index();
+    std::string entries;
+    std::string elements;
+    std::string texts;
+    std::uint32_t nb_entries = 0;
+    std::uint32_t nb_elements = 0;
+    while(!text.empty()) {
+        std::size_t end = text.find('\n');
+        string_view line = detail::trim_config_spaces(text.substr(0, end));
+        text.remove_prefix(end != string_view::npos ? end + 1 : text.size());
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::size_t equal = line.find('=');
+        string_view name = detail::trim_config_spaces(line.substr(0, equal));
+        std::size_t option = application.find_long(name);
+        if(option == no_option) {
+            return detail::fail_config(line, error);
+        }
+        std::uint32_t nb_entry_elements = 0;
+        if(equal != string_view::npos) {
+            detail::SplitArgumentSource source{line.substr(equal + 1)};
+            while(std::optional<string_view> element = source.next()) {
+                detail::append_u32(elements, static_cast<std::uint32_t>(texts.size()));
+                detail::append_u32(elements, static_cast<std::uint32_t>(element->size()));
+                texts.append(element->data(), element->size());
+                nb_entry_elements += 1;
+            }
+        }
+        std::size_t nb_value_elements = application.options_[option]->value_names().size;
+        if(nb_value_elements == 0 ? nb_entry_elements > 1
+                                  : nb_entry_elements != nb_value_elements) {
+            return detail::fail_config(line, error);
+        }
+        detail::append_u32(entries, static_cast<std::uint32_t>(option));
+        detail::append_u32(entries, nb_entry_elements);
+        nb_entries += 1;
+        nb_elements += nb_entry_elements;
+    }
+    built_.clear();
+    built_.reserve(detail::config_header_size + entries.size() + elements.size() + texts.size());
+    built_.append(detail::config_magic, sizeof(detail::config_magic));
+    detail::append_u64(built_, application.schema_hash());
+    detail::append_u32(built_, nb_entries);
+    detail::append_u32(built_, nb_elements);
+    built_ += entries;
+    built_ += elements;
+    built_ += texts;
+    data_ = built_;
+    nb_entries_ = nb_entries;
+    nb_elements_ = nb_elements;
+    return true;
+}
+
+ROPTS_INLINE bool ConfigValues::try_load_file(
+    Application const & application, string_view path, ParseError & error) {
+    string_view text;
+    if(!files_.try_load(path, text)) {
+        return detail::fail_config(path, error);
+    }
+    return try_load_text(application, text, error);
+}
+
+namespace detail {
+// Check the structure of a binary form : everything try_apply reads is in bounds and consistent.
+ROPTS_LOCAL bool
+is_valid_config(string_view data, std::uint64_t schema_hash, std::size_t nb_options) noexcept {
+    if(data.size() < config_header_size ||
+       string_view(data.data(), sizeof(config_magic)) !=
+           string_view(config_magic, sizeof(config_magic)) ||
+       read_u64(data, 8) != schema_hash) {
+        return false;
+    }
+    std::uint64_t nb_entries = read_u32(data, 16);
+    std::uint64_t nb_elements = read_u32(data, 20);
+    std::uint64_t elements = config_header_size + nb_entries * config_record_size;
+    std::uint64_t texts = elements + nb_elements * config_record_size;
+    if(texts > data.size()) {
+        return false;
+    }
+    std::uint64_t nb_entry_elements = 0;
+    for(std::uint64_t i = 0; i < nb_entries; ++i) {
+        std::size_t entry = config_header_size + i * config_record_size;
+        if(read_u32(data, entry) >= nb_options) {
+            return false;
+        }
+        nb_entry_elements += read_u32(data, entry + 4);
+    }
+    if(nb_entry_elements != nb_elements) {
+        return false;
+    }
+    std::uint64_t texts_size = data.size() - texts;
+    for(std::uint64_t i = 0; i < nb_elements; ++i) {
+        std::size_t element = elements + i * config_record_size;
+        if(std::uint64_t(read_u32(data, element)) + read_u32(data, element + 4) > texts_size) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace detail
+
+ROPTS_INLINE bool ConfigValues::try_load_snapshot(
+    Application const & application, string_view path, ParseError & error) {
+    string_view data;
+    if(!files_.try_load(path, data) ||
+       !detail::is_valid_config(data, application.schema_hash(), application.options_.size())) {
+        return detail::fail_config(path, error);
+    }
+    built_.clear();
+    data_ = data;
+    nb_entries_ = detail::read_u32(data, 16);
+    nb_elements_ = detail::read_u32(data, 20);
+    return true;
+}
+
+ROPTS_INLINE bool ConfigValues::try_save_snapshot(string_view path, ParseError & error) const {
+    if(data_.empty()) {
+        return detail::fail_config(path, error); // Nothing loaded
+    }
+    std::FILE * f = std::fopen(std::string(path).c_str(), "wb");
+    if(f == nullptr) {
+        return detail::fail_config(path, error);
+    }
+    bool ok = std::fwrite(data_.data(), 1, data_.size(), f) == data_.size();
+    ok = std::fclose(f) == 0 && ok;
+    return ok || detail::fail_config(path, error);
+}
+
+ROPTS_INLINE bool ConfigValues::try_apply(
+    Application & application, std::vector<bool> const & skip, ParseError & error) const {
+    if(data_.empty()) {
+        return true;
+    }
+    // Options changed since loading
+    assert(detail::read_u64(data_, 8) == application.schema_hash());
+    std::size_t entry = detail::config_header_size;
+    std::size_t element = entry + nb_entries_ * detail::config_record_size;
+    std::size_t const texts = element + nb_elements_ * detail::config_record_size;
+    for(std::uint32_t i = 0; i < nb_entries_; ++i) {
+        std::uint32_t option = detail::read_u32(data_, entry);
+        std::uint32_t nb_entry_elements = detail::read_u32(data_, entry + 4);
+        if(!skip[option]) {
+            detail::ConfigElementSource elements{data_, element, nb_entry_elements, texts};
+            if(!detail::apply_fallback(*application.options_[option], elements, {}, error)) {
+                return false;
+            }
+        }
+        entry += detail::config_record_size;
+        element += nb_entry_elements * detail::config_record_size;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * IncrementalParser
+ */
+
+namespace detail {
+// Elements of an IncrementalParser, from a position
+class ElementsArgumentSource final : public ArgumentSource {
+  public:
+    ElementsArgumentSource(std::deque<std::string> const & elements, std::size_t first) noexcept
+        : elements_(elements), next_(first) {}
+    std::optional<string_view> next() override {
+        if(next_ < elements_.size()) {
+            next_ += 1;
+            return string_view{elements_[next_ - 1]};
+        }
+        return {};
+    }
+
+  private:
+    std::deque<std::string> const & elements_;
+    std::size_t next_;
+};
+} // namespace detail
+
+// Const parsing registry, recording changed results of the current step for rollback.
+struct IncrementalParser::Registry {
+    IncrementalParser & parser;
+    Application::ResultsRegistry results;
+
+    std::size_t find_short(char name) const noexcept { return results.find_short(name); }
+    std::size_t find_long(string_view name) const noexcept { return results.find_long(name); }
+    bool takes_value(std::size_t id) const noexcept { return results.takes_value(id); }
+    bool parse_option(std::size_t id, CommandLine & state, ParseError & error) {
+        std::vector<Undo> & undo = parser.undo_;
+        auto step_undo = undo.begin() + std::ptrdiff_t(parser.steps_.back().first_undo);
+        if(std::none_of(step_undo, undo.end(), [id](Undo const & u) { return u.option == id; })) {
+            std::uint64_t const * bits = parser.results_.occurrence_bits_.data();
+            bool occurred = (bits[id / 64] >> (id % 64)) & 1;
+            OptionResultBase const & result = *parser.results_.results_[id];
+            std::size_t const mark = result.mark();
+            std::unique_ptr<OptionResultBase> copy =
+                mark == OptionResultBase::no_mark ? result.clone() : nullptr;
+            undo.push_back(Undo{id, std::move(copy), mark, result.nb_occurrences, occurred});
+        }
+        return results.parse_option(id, state, error);
+    }
+    bool parse_positional(
+        string_view element, bool after_separator, CommandLine & state, ParseError & error) {
+        return results.parse_positional(element, after_separator, state, error);
+    }
+};
+
+ROPTS_INLINE IncrementalParser::IncrementalParser(Application const & application)
+    : application_(application), results_(application.make_results()) {}
+
+ROPTS_INLINE bool IncrementalParser::append(string_view element, ParseError & error) {
+    error = ParseError{};
+    std::size_t const previous_size = elements_.size();
+    elements_.emplace_back(element);
+    if(!resume(error)) {
+        truncate(previous_size);
+        return false;
+    }
+    return true;
+}
+
+ROPTS_INLINE void IncrementalParser::truncate(std::size_t size) {
+    if(size >= elements_.size()) {
+        return;
+    }
+    std::size_t nb_steps = 0;
+    while(nb_steps < steps_.size() && steps_[steps_.size() - 1 - nb_steps].end_element > size) {
+        nb_steps += 1;
+    }
+    undo_steps(nb_steps);
+    elements_.resize(size);
+    // Remaining elements of a partially removed step are incomplete
+    ParseError error;
+    if(!resume(error)) {
+        elements_.resize(nb_parsed_);
+    }
+}
+
+ROPTS_INLINE bool IncrementalParser::try_finish(ParseError & error) const {
+    if(!is_complete()) {
+        error = incomplete_error_;
+        return false;
+    }
+    return application_.check_groups(results_.occurrence_bits_.data(), error);
+}
+
+ROPTS_INLINE bool IncrementalParser::resume(ParseError & error) {
+    while(nb_parsed_ < elements_.size()) {
+        detail::ElementsArgumentSource source{elements_, nb_parsed_};
+        CommandLine command_line{source};
+        std::size_t const nb_positionals = results_.positionals_.size();
+        steps_.push_back(
+            Step{nb_parsed_, nb_parsed_, undo_.size(), nb_positionals, enable_option_parsing_});
+        std::optional<string_view> element = command_line.next(error);
+        assert(element);
+        Registry registry{*this, Application::ResultsRegistry{application_, results_}};
+        if(!try_parse_element(registry, *element, command_line, enable_option_parsing_, error)) {
+            std::size_t const failed_element = nb_parsed_ + command_line.element_index() - 1;
+            undo_steps(1);
+            if(error.code == ErrorCode::MissingValue) {
+                // Values are not there yet
+                incomplete_error_ = std::move(error);
+                error = ParseError{};
+                return true;
+            }
+            error.element_index = failed_element;
+            return false;
+        }
+        nb_parsed_ += command_line.element_index();
+        steps_.back().end_element = nb_parsed_;
+    }
+    return true;
+}
+
+ROPTS_INLINE void IncrementalParser::undo_steps(std::size_t nb_steps) {
+    for(; nb_steps > 0; --nb_steps) {
+        Step const & step = steps_.back();
+        for(std::size_t i = undo_.size(); i > step.first_undo; --i) {
+            Undo & undo = undo_[i - 1];
+            std::unique_ptr<OptionResultBase> & result = results_.results_[undo.option];
+            if(undo.result != nullptr) {
+                result = std::move(undo.result);
+            } else {
+                result->truncate(undo.mark);
+                result->nb_occurrences = undo.nb_occurrences;
+            }
+            std::uint64_t & word = results_.occurrence_bits_[undo.option / 64];
+            std::uint64_t const bit = std::uint64_t(1) << (undo.option % 64);
+            word = undo.occurred ? (word | bit) : (word & ~bit);
+        }
+        undo_.resize(step.first_undo);
+        results_.positionals_.truncate(step.nb_positionals);
+        enable_option_parsing_ = step.enable_option_parsing;
+        nb_parsed_ = step.first_element;
+        steps_.pop_back();
+    }
+}
+
+/******************************************************************************
+ * OptionTable
+ */
+ROPTS_INLINE std::uint32_t OptionTable::add_option(
+    OptionNames const & names,
+    std::size_t nb_value_elements,
+    ParseFunction parse_function,
+    Slot slot) {
+    assert(names.short_name != '\0' || !names.long_name.empty());
+    assert(nb_value_elements <= UINT8_MAX);
+    auto const index = static_cast<std::uint32_t>(nb_occurrences_.size());
+    if(names.short_name != '\0') {
+        std::uint32_t & entry = short_name_index_[static_cast<unsigned char>(names.short_name)];
+        assert(entry == no_option_index); // Short names must be unique
+        entry = index;
+    }
+    short_names_.push_back(names.short_name);
+    long_names_.push_back(LongName{
+        static_cast<std::uint32_t>(name_storage_.size()),
+        static_cast<std::uint32_t>(names.long_name.size())});
+    name_storage_.append(names.long_name.data(), names.long_name.size());
+    nb_occurrences_.push_back(0);
+    nb_value_elements_.push_back(static_cast<std::uint8_t>(nb_value_elements));
+    parse_functions_.push_back(parse_function);
+    slots_.push_back(std::move(slot));
+    if(!names.long_name.empty()) {
+        auto it = std::lower_bound(
+            long_name_index_.begin(),
+            long_name_index_.end(),
+            names.long_name,
+            [this](std::uint32_t option, string_view name) { return long_name(option) < name; });
+        assert(it == long_name_index_.end() || long_name(*it) != names.long_name); // Unique
+        long_name_index_.insert(it, index);
+    }
+    return index;
+}
+
+ROPTS_INLINE string_view OptionTable::long_name(std::size_t index) const noexcept {
+    LongName const & name = long_names_[index];
+    return string_view{name_storage_.data() + name.offset, name.size};
+}
+ROPTS_INLINE string_view OptionTable::option_name(std::size_t index) const noexcept {
+    if(long_names_[index].size > 0) {
+        return long_name(index);
+    } else {
+        return string_view{&short_names_[index], 1};
+    }
+}
+
+ROPTS_INLINE std::size_t OptionTable::find_short(char name) const noexcept {
+    ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+    std::uint32_t option_index = short_name_index_[static_cast<unsigned char>(name)];
+    return option_index != no_option_index ? option_index : no_option;
+}
+
+ROPTS_INLINE std::size_t OptionTable::find_long(string_view name) const noexcept {
+    ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+    auto it = std::lower_bound(
+        long_name_index_.begin(),
+        long_name_index_.end(),
+        name,
+        [this](std::uint32_t option, string_view name) { return long_name(option) < name; });
+    if(it != long_name_index_.end() && long_name(*it) == name) {
+        return *it;
+    } else {
+        return no_option;
+    }
+}
+
+ROPTS_INLINE bool
+OptionTable::parse_option(std::size_t id, CommandLine & state, ParseError & error) {
+    ParseFunction parse_function = parse_functions_[id];
+    if(parse_function != nullptr &&
+       !parse_function(slots_[id].get(), nb_occurrences_[id], state, error)) {
+        error.option_name = option_name(id);
+        return false;
+    }
+    nb_occurrences_[id] += 1;
+    return true;
+}
+
+ROPTS_INLINE void OptionTable::parse(CommandLine command_line) {
+    ParseError error;
+    if(!try_parse(command_line, error)) {
+        throw_exception(error.message());
+    }
+}
+ROPTS_INLINE bool OptionTable::try_parse(CommandLine command_line, ParseError & error) {
+    return try_parse_options(*this, command_line, error);
+}
+
+} // namespace ropts
 
-} // namespace ropts
\ No newline at end of file
+#undef ROPTS_INLINE
+#undef ROPTS_LOCAL
+#undef ROPTS_HAS_MMAP
+#endif
@@ -1,15 +1,29 @@
 #ifndef ROPTS_INCLUDE_GUARD
 #define ROPTS_INCLUDE_GUARD
 
+#include <algorithm> // std::count in List
 #include <array>
 #include <cassert>
+#ifdef ROPTS_INSTRUMENTATION
+#include <chrono>
+#endif
 #include <cstdint>   // std::uint32_t in CowStr
 #include <cstdio>    // std::FILE
+#include <deque>     // IncrementalParser elements
 #include <exception> // std::exception
+#include <functional> // std::function
+#include <initializer_list> // Application::add
 #include <iosfwd>    // std::ostream
-#include <string>    // std::char_traits in CowStr
+#include <iterator>  // Positionals::Iterator
+#include <list>      // Application subcommands
+#include <memory>    // std::allocator_arg_t
+#include <memory_resource>
+#include <string> // std::char_traits in CowStr
 #include <tuple>
-#include <utility> // move, index_sequence
+#include <type_traits> // is_final in OptionBase::parse_static
+#include <unordered_map> // Application subcommands
+#include <unordered_set> // StringInterner
+#include <utility>     // move, index_sequence
 #include <vector>
 
 // TODO compat C++14 ?
@@ -25,27 +39,125 @@ using std::string_view;
  *
  * Avoids allocations whevener possible.
  * Allocates when:
- * - non literal strings are used.
+ * - non literal strings longer than CowStr::inline_capacity are used.
  * - errors are returned.
+ *
+ * Allocations can be redirected to a std::pmr::memory_resource (arena) :
+ * - Application registration and index storage : Application constructor.
+ * - non literal strings : CowStr::copied(s, resource), or a StringInterner to share copies.
+ * - OptionMultiple values : pmr::OptionMultiple<T>.
+ * - Lazy option elements : {std::allocator_arg, allocator, names...} constructor.
+ * - Positionals elements : Positionals constructor.
+ * - ParseResults storage and usage text cache : from the Application resource.
+ * Error messages always use the global allocator, as exceptions outlive the parsing scope.
+ * Also from the global allocator : one result object per option in ParseResults (make_result),
+ * OptionMultipleLazy::values() conversions, ResponseFiles, ConfigValues, IncrementalParser
+ * history and StaticApplication.
+ *
+ * Header-only mode : define ROPTS_HEADER_ONLY for all translation units. ropts.h then includes
+ * ropts.cpp (keep it next to ropts.h) with all definitions inline, and nothing is linked.
+ * The compiler can inline parsing into the caller, at the cost of compile time.
+ * POSIX headers used for mmap are then included by ropts.h, after the library declarations.
  */
 namespace ropts {
 
+/******************************************************************************
+ * Instrumentation (opt-in) : define ROPTS_INSTRUMENTATION for all translation units.
+ * Counters are per thread, and can be reset with instrumentation() = {}.
+ */
+#ifdef ROPTS_INSTRUMENTATION
+struct Instrumentation {
+    // Heap allocations done by ropts : CowStr copies, error messages, growth of vectors.
+    std::size_t nb_allocations = 0;
+    std::size_t nb_owned_copies = 0; // CowStr owning a copy
+    std::size_t nb_lookups = 0;      // Option name lookups
+    std::size_t nb_next_calls = 0;   // CommandLine::next()
+    // Time spent in phases of Application::parse
+    std::chrono::nanoseconds index_duration{0};
+    std::chrono::nanoseconds prescan_duration{0};
+    std::chrono::nanoseconds parse_duration{0};
+
+    // Count an allocation if a vector capacity changed
+    void count_growth(std::size_t old_capacity, std::size_t new_capacity) noexcept {
+        nb_allocations += old_capacity != new_capacity ? 1 : 0;
+    }
+};
+Instrumentation & instrumentation() noexcept;
+#define ROPTS_INSTRUMENT(statement) statement
+#else
+#define ROPTS_INSTRUMENT(statement)
+#endif
+
 /// Exception type used to report parsing errors.
 struct Exception final : std::exception {
     std::string error;
 
     Exception() = default;
-    Exception(std::string && message) : error(std::move(message)) {}
+    Exception(std::string && message) : error(std::move(message)) {
+        ROPTS_INSTRUMENT(instrumentation().nb_allocations += 1);
+    }
 
     char const * what() const noexcept override { return error.data(); }
 };
 
+// Exceptions may be disabled (-fno-exceptions) : functions reporting errors by Exception then
+// print the message and abort, and the try_parse functions must be used instead.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define ROPTS_EXCEPTIONS 1
+#else
+#define ROPTS_EXCEPTIONS 0
+#endif
+
+/// Throws Exception(message), or aborts with the message if exceptions are disabled.
+[[noreturn]] void throw_exception(std::string && message);
+
+/******************************************************************************
+ * Error description for the non-throwing try_parse functions.
+ * Fields are views on the command line and option definitions (no allocation), and the message
+ * is only formatted on demand : message() returns the same text as the Exception.
+ * Parsing functions reset it on entry, so it can be reused after a failed parse.
+ */
+enum class ErrorCode : std::uint8_t {
+    None,
+    UnknownOption,   // text : element, name : unknown name in it
+    UnexpectedValue, // text : '--name=value' element, of an option without value
+    MissingValue,    // value_name
+    RepeatedOption,  // option
+    InvalidValue,    // text : value, value_name, type_name
+    ResponseFile,    // text : path of the file
+    UnexpectedPositional, // text : element, with no Positionals to store it
+    Config,          // text : invalid configuration line, or path of a snapshot
+    ExclusiveOptions, // option, name : other option of a mutually exclusive group
+    MissingOption,   // text : name of a group requiring an option
+    Other,           // other_message : exception from a user ValueTrait or callback
+};
+
+class OptionBase;
+
+struct ParseError {
+    ErrorCode code = ErrorCode::None;
+    // Index of the element being parsed : argv index ('@path' element for response file tokens),
+    // or number of elements read from an ArgumentSource.
+    std::size_t element_index = 0;
+    OptionBase const * option = nullptr; // Option being parsed, if any
+    string_view option_name;             // Name of option, if not an OptionBase (OptionTable)
+    string_view text;
+    string_view name;
+    string_view value_name;
+    string_view type_name;
+    std::string other_message;
+
+    explicit operator bool() const noexcept { return code != ErrorCode::None; }
+    std::string message() const;
+};
+
 /// Slice<T> : reference to const T[n]
 template <typename T> struct Slice {
     const T * base{nullptr};
     std::size_t size{0};
 
     Slice() noexcept = default;
+    Slice(const T * base_, std::size_t size_) noexcept : base(base_), size(size_) {}
     template <std::size_t N>
     explicit Slice(std::array<T, N> const & a) noexcept : base(a.data()), size(N) {}
     explicit Slice(T const & t) noexcept : base(&t), size(1) {}
@@ -61,41 +173,52 @@ template <typename T> struct Slice {
  * The string content is not mutable in place.
  * The CowStr can be reassigned a new value.
  * The content can be accessed as a string_view.
+ *
+ * Owned strings of up to inline_capacity chars are stored inside the CowStr, without allocation.
+ * Views to such a string are invalidated when the CowStr is moved or destroyed.
  */
 class CowStr {
   public:
     enum class Type : bool { Borrowed, Owned };
+    static constexpr std::size_t inline_capacity = 14;
 
     constexpr CowStr() noexcept = default;
     ~CowStr() {
         delete_owned();
-        state_ = default_state_;
+        state_ = State{};
     }
 
     CowStr(CowStr const &) = delete;
     CowStr & operator=(CowStr const &) = delete;
 
-    CowStr(CowStr && cow) noexcept : state_{cow.state_} { cow.state_ = default_state_; }
+    CowStr(CowStr && cow) noexcept : state_{cow.state_} { cow.state_ = State{}; }
     CowStr & operator=(CowStr && cow) noexcept {
         delete_owned();
         state_ = cow.state_;
-        cow.state_ = default_state_;
+        cow.state_ = State{};
         return *this;
     }
 
     /// Raw constructor
-    CowStr(char const * start, std::size_t size, Type type) noexcept
-        : state_{start, static_cast<std::uint32_t>(size), type} {
+    CowStr(char const * start, std::size_t size, Type type) noexcept {
         assert(size <= UINT32_MAX);
         assert(start != nullptr);
+        Storage storage = type == Type::Owned ? Storage::Owned : Storage::Borrowed;
+        state_.external = {storage, static_cast<std::uint32_t>(size), start};
     }
 
     /// Anything string_view compatible : own a copy by default, safer
     explicit CowStr(string_view s) : CowStr() {
-        if(!s.empty()) {
+        if(s.size() > inline_capacity) {
+            ROPTS_INSTRUMENT(instrumentation().nb_allocations += 1);
+            ROPTS_INSTRUMENT(instrumentation().nb_owned_copies += 1);
             char * buf = reinterpret_cast<char *>(operator new(s.size() * sizeof(char)));
             std::char_traits<char>::copy(buf, s.data(), s.size());
-            state_ = {buf, static_cast<std::uint32_t>(s.size()), Type::Owned};
+            state_.external = {Storage::Owned, static_cast<std::uint32_t>(s.size()), buf};
+        } else if(!s.empty()) {
+            ROPTS_INSTRUMENT(instrumentation().nb_owned_copies += 1);
+            state_.small = {Storage::Inline, static_cast<std::uint8_t>(s.size()), {}};
+            std::char_traits<char>::copy(state_.small.chars, s.data(), s.size());
         }
     }
     CowStr & operator=(string_view s) noexcept { return *this = CowStr(s); }
@@ -103,6 +226,16 @@ class CowStr {
     /// Borrow from string_view compatible : must be explicit
     static CowStr borrowed(string_view s) { return {s.data(), s.size(), Type::Borrowed}; }
 
+    /// Copy to memory from resource (arena), which owns it : the CowStr is Borrowed.
+    static CowStr copied(string_view s, std::pmr::memory_resource & resource) {
+        if(s.empty()) {
+            return {};
+        }
+        char * buf = static_cast<char *>(resource.allocate(s.size() * sizeof(char), alignof(char)));
+        std::char_traits<char>::copy(buf, s.data(), s.size());
+        return {buf, s.size(), Type::Borrowed};
+    }
+
     /// String literal : borrow by default
     template <std::size_t N>
     CowStr(char const (&s)[N]) noexcept : CowStr{&s[0], N - 1, Type::Borrowed} {
@@ -114,56 +247,376 @@ class CowStr {
     }
 
     // Access
-    string_view view() const noexcept { return {state_.start, state_.size}; }
+    string_view view() const noexcept { return {data(), size()}; }
     operator string_view() const noexcept { return view(); }
-    char const * data() const noexcept { return state_.start; }
-    std::size_t size() const noexcept { return state_.size; }
-    Type type() const noexcept { return state_.type; }
+    char const * data() const noexcept {
+        return is_inline() ? state_.small.chars : state_.external.start;
+    }
+    std::size_t size() const noexcept {
+        return is_inline() ? state_.small.size : state_.external.size;
+    }
+    /// Inline strings are Owned
+    Type type() const noexcept {
+        return state_.external.storage == Storage::Borrowed ? Type::Borrowed : Type::Owned;
+    }
     bool empty() const noexcept { return size() == 0; }
 
   private:
-    struct RawState {
-        char const * start;
+    enum class Storage : std::uint8_t { Borrowed, Owned, Inline };
+    // Both layouts start with storage : it can be read from either (common initial sequence).
+    struct External {
+        Storage storage;
         std::uint32_t size; // 32 bits are sufficient ; struct 30% smaller due to padding
-        Type type;
+        char const * start;
     };
-    static constexpr RawState default_state_{"", 0, Type::Borrowed};
-    RawState state_{default_state_};
+    struct Inline {
+        Storage storage;
+        std::uint8_t size;
+        char chars[inline_capacity];
+    };
+    union State {
+        External external{Storage::Borrowed, 0, ""};
+        Inline small;
+    };
+    State state_{};
 
+    bool is_inline() const noexcept { return state_.small.storage == Storage::Inline; }
     void delete_owned() noexcept {
-        if(state_.type == Type::Owned) {
-            operator delete(const_cast<char *>(state_.start));
+        if(state_.external.storage == Storage::Owned) {
+            operator delete(const_cast<char *>(state_.external.start));
         }
     }
 };
 
 static_assert(sizeof(CowStr) == sizeof(string_view));
 
+/******************************************************************************
+ * StringInterner:
+ * Stores one copy of each distinct string, allocated from resource.
+ * intern() returns Borrowed CowStr to these copies : options can share value names and help texts
+ * generated at runtime. The interner must outlive the CowStr it returned.
+ */
+class StringInterner {
+  public:
+    explicit StringInterner(
+        std::pmr::memory_resource * resource = std::pmr::get_default_resource()) noexcept
+        : strings_(resource) {}
+    ~StringInterner();
+
+    StringInterner(StringInterner const &) = delete;
+    StringInterner & operator=(StringInterner const &) = delete;
+
+    CowStr intern(string_view s);
+    /// Number of distinct strings stored
+    std::size_t size() const noexcept { return strings_.size(); }
+
+  private:
+    std::pmr::unordered_set<string_view> strings_; // Views to copies from the set resource
+};
+
+/******************************************************************************
+ * StaticNameTable<N>:
+ * Perfect hash table over a set of N names known at compile time.
+ * The table is built by a constexpr constructor (hash and displace) : names are dispatched in
+ * buckets by a first hash, then each bucket gets a seed placing all its names in free slots.
+ * Lookup costs two hashes of the searched name and one comparison.
+ * Empty names are ignored (never found), which is used for options without long names.
+ * Names must be unique : a duplicate fails the compile-time evaluation, or throws at runtime.
+ */
+
+/// Throws for a name given twice to a static table (not constexpr : fails constant evaluation).
+[[noreturn]] void fail_duplicate_name(string_view name);
+constexpr std::uint32_t hash_name(string_view name, std::uint32_t seed) noexcept {
+    // FNV-1a, with seed mixed in the offset basis
+    std::uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    for(std::size_t i = 0; i < name.size(); ++i) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr std::size_t next_power_of_two(std::size_t n) noexcept {
+    std::size_t p = 1;
+    while(p < n) {
+        p *= 2;
+    }
+    return p;
+}
+
+template <std::size_t N> class StaticNameTable {
+  public:
+    /// Returned by find() if the name is not in the table.
+    static constexpr std::size_t not_found = N;
+
+    constexpr explicit StaticNameTable(std::array<string_view, N> const & names) : names_(names) {
+        // Sort names by bucket (counting sort)
+        std::array<std::size_t, nb_buckets + 1> bucket_start{};
+        for(std::size_t i = 0; i < N; ++i) {
+            if(!names_[i].empty()) {
+                bucket_start[bucket_of(names_[i]) + 1] += 1;
+            }
+        }
+        for(std::size_t b = 0; b < nb_buckets; ++b) {
+            bucket_start[b + 1] += bucket_start[b];
+        }
+        std::array<std::uint32_t, N + 1> members{}; // +1 : avoid zero sized array
+        {
+            std::array<std::size_t, nb_buckets> fill{};
+            for(std::size_t i = 0; i < N; ++i) {
+                if(!names_[i].empty()) {
+                    std::size_t b = bucket_of(names_[i]);
+                    members[bucket_start[b] + fill[b]] = static_cast<std::uint32_t>(i);
+                    fill[b] += 1;
+                }
+            }
+        }
+        // Equal names share a bucket, and placing them would never terminate
+        for(std::size_t b = 0; b < nb_buckets; ++b) {
+            for(std::size_t i = bucket_start[b]; i < bucket_start[b + 1]; ++i) {
+                for(std::size_t j = i + 1; j < bucket_start[b + 1]; ++j) {
+                    if(names_[members[i]] == names_[members[j]]) {
+                        fail_duplicate_name(names_[members[i]]);
+                    }
+                }
+            }
+        }
+        // Place buckets from the biggest, as they are the hardest to place.
+        std::array<bool, nb_buckets> placed{};
+        for(std::size_t n = 0; n < nb_buckets; ++n) {
+            std::size_t bucket = 0;
+            std::size_t bucket_size = 0;
+            for(std::size_t b = 0; b < nb_buckets; ++b) {
+                std::size_t size = bucket_start[b + 1] - bucket_start[b];
+                if(!placed[b] && (size > bucket_size || bucket_size == 0)) {
+                    bucket = b;
+                    bucket_size = size;
+                }
+            }
+            placed[bucket] = true;
+            if(bucket_size == 0) {
+                break; // Remaining buckets are empty
+            }
+            for(std::uint32_t seed = 1;; ++seed) {
+                // Try to place all names of the bucket, rollback on collision
+                std::size_t nb_placed = 0;
+                for(; nb_placed < bucket_size; ++nb_placed) {
+                    std::uint32_t name = members[bucket_start[bucket] + nb_placed];
+                    std::size_t slot = slot_of(names_[name], seed);
+                    if(slots_[slot] != empty_slot) {
+                        break;
+                    }
+                    slots_[slot] = name;
+                }
+                if(nb_placed == bucket_size) {
+                    seeds_[bucket] = seed;
+                    break;
+                }
+                for(std::size_t i = 0; i < nb_placed; ++i) {
+                    std::uint32_t name = members[bucket_start[bucket] + i];
+                    slots_[slot_of(names_[name], seed)] = empty_slot;
+                }
+            }
+        }
+    }
+
+    /// Returns the index of name in the table, or not_found.
+    constexpr std::size_t find(string_view name) const noexcept {
+        std::uint32_t seed = seeds_[bucket_of(name)];
+        if(seed == 0) {
+            return not_found; // Empty bucket
+        }
+        std::uint32_t index = slots_[slot_of(name, seed)];
+        if(index != empty_slot && names_[index] == name) {
+            return index;
+        } else {
+            return not_found;
+        }
+    }
+
+    constexpr string_view operator[](std::size_t i) const noexcept { return names_[i]; }
+    constexpr std::size_t size() const noexcept { return N; }
+
+  private:
+    // Load factor of 1/2 for slots, 2 names per bucket in average
+    static constexpr std::size_t nb_slots = next_power_of_two(2 * N);
+    static constexpr std::size_t nb_buckets = next_power_of_two(N / 2 + 1);
+    static constexpr std::uint32_t empty_slot = UINT32_MAX;
+
+    std::array<string_view, N> names_{};
+    std::array<std::uint32_t, nb_buckets> seeds_{}; // 0 for empty buckets
+    std::array<std::uint32_t, nb_slots> slots_ = make_empty_slots();
+
+    static constexpr std::array<std::uint32_t, nb_slots> make_empty_slots() noexcept {
+        std::array<std::uint32_t, nb_slots> slots{};
+        for(std::size_t i = 0; i < nb_slots; ++i) {
+            slots[i] = empty_slot;
+        }
+        return slots;
+    }
+    static constexpr std::size_t bucket_of(string_view name) noexcept {
+        return hash_name(name, 0) & (nb_buckets - 1);
+    }
+    static constexpr std::size_t slot_of(string_view name, std::uint32_t seed) noexcept {
+        return hash_name(name, seed) & (nb_slots - 1);
+    }
+};
+
+template <typename... Names>
+constexpr StaticNameTable<sizeof...(Names)> make_name_table(Names... names) {
+    return StaticNameTable<sizeof...(Names)>{{string_view(names)...}};
+}
+
+/******************************************************************************
+ * Response files : storage for files referenced by '@path' command line elements.
+ * Regular files are memory-mapped. Others (pipes, devices like /dev/stdin, procfs files) and all
+ * files if mmap is not available are read at once. They stay alive as long as the ResponseFiles
+ * object. A file referenced multiple times is loaded once.
+ */
+class ResponseFiles {
+  public:
+    ResponseFiles() = default;
+    ~ResponseFiles();
+
+    // Cannot be relocated (referenced by CommandLine)
+    ResponseFiles(ResponseFiles const &) = delete;
+    ResponseFiles(ResponseFiles &&) = delete;
+    ResponseFiles & operator=(ResponseFiles const &) = delete;
+    ResponseFiles & operator=(ResponseFiles &&) = delete;
+
+    // Returns file content, or throw if the file cannot be read.
+    string_view load(string_view path);
+    // Same as load(), returning false if the file cannot be read.
+    bool try_load(string_view path, string_view & content);
+
+  private:
+    struct File {
+        std::string path;
+        char const * data;
+        std::size_t size;
+        bool mapped; // Else allocated with new[]
+    };
+    std::vector<File> files_;
+};
+
+/******************************************************************************
+ * ArgumentSource : generic source of command line elements, for streaming.
+ * Returned elements must stay valid at least until the next call to next().
+ */
+class ArgumentSource {
+  public:
+    virtual ~ArgumentSource() = default;
+    virtual std::optional<string_view> next() = 0;
+};
+
+/// Reads elements separated by 'separator' from a stream, by chunks (constant memory).
+/// Chunks grow only to fit an element bigger than the current chunk.
+/// Elements are only valid until the next call to next() : string_view values must be copied.
+class StreamArgumentSource final : public ArgumentSource {
+  public:
+    explicit StreamArgumentSource(
+        std::FILE * in, char separator = '\0', std::size_t chunk_size = 64 * 1024);
+
+    std::optional<string_view> next() override;
+
+  private:
+    std::FILE * in_;
+    char separator_;
+    std::vector<char> buffer_;
+    std::size_t begin_ = 0; // Unread data in buffer_ is [begin_, end_)
+    std::size_t end_ = 0;
+    bool end_of_stream_ = false;
+};
+
+/// Iterates over a fixed list of elements, which must outlive the source.
+class SliceArgumentSource final : public ArgumentSource {
+  public:
+    explicit SliceArgumentSource(Slice<string_view> elements) noexcept : elements_(elements) {}
+
+    std::optional<string_view> next() override {
+        if(next_ < elements_.size) {
+            next_ += 1;
+            return elements_[next_ - 1];
+        } else {
+            return {};
+        }
+    }
+
+  private:
+    Slice<string_view> elements_;
+    std::size_t next_ = 0;
+};
+
 /******************************************************************************
  * Iterates over a command line, returning string_view elements.
+ *
+ * If constructed with a ResponseFiles storage, an element '@path' is replaced by the tokens of
+ * the file. Tokens are separated by newlines or NUL characters, and empty tokens are skipped.
+ * There is no quoting, and no recursive expansion of '@path' tokens within a file.
+ * Tokens are string_view into the file mapping, valid as long as the ResponseFiles.
+ *
+ * If constructed from an ArgumentSource, elements are read from it incrementally.
+ * Element lifetime is then defined by the source, and a copy of the CommandLine shares the
+ * source state (see is_restartable()).
  */
 class CommandLine {
   public:
     CommandLine(int argc, char const * const * argv) : argc_(argc), argv_(argv) {
         assert(argc_ > 0);
     }
+    CommandLine(int argc, char const * const * argv, ResponseFiles & response_files)
+        : argc_(argc), argv_(argv), response_files_(&response_files) {
+        assert(argc_ > 0);
+    }
+    explicit CommandLine(ArgumentSource & source) noexcept
+        : argc_(0), argv_(nullptr), source_(&source) {}
+
+    // True if copies iterate independently (not reading from an ArgumentSource).
+    bool is_restartable() const noexcept { return source_ == nullptr; }
 
-    // Extract the next element
+    // Extract the next element, throw if a response file cannot be read.
     std::optional<string_view> next();
+    // Same as next(), returning nothing and filling error if a response file cannot be read.
+    std::optional<string_view> next(ParseError & error);
 
     // Extract one element, or throw with "missing value <value_name>" message.
     string_view next_value_or_fail(string_view value_name);
-
-    // Place an element at the front (only one at a time). Used to peek values.
+    // Same as next_value_or_fail(), returning false and filling error.
+    bool next_value(string_view & value, string_view value_name, ParseError & error);
+
+    // Index of the last extracted element (see ParseError::element_index).
+    std::size_t element_index() const noexcept { return element_index_; }
+    // Position in argv of the last extracted element, or nullptr if it was not read from argv
+    // (pending element, response file, ArgumentSource).
+    char const * const * last_argv_element() const noexcept {
+        return last_from_argv_ ? argv_ + element_index_ : nullptr;
+    }
+    // Extract all remaining elements at once as a slice of argv, without copy.
+    // Returns false if they may not all be argv elements : pending elements, ArgumentSource, or
+    // response files enabled (they would be expanded by next()).
+    bool take_remaining_argv(Slice<char const *> & elements) noexcept;
+
+    // Place an element at the front. Used to peek values, or to feed the value of
+    // '--name=value' and '-fVALUE' elements. Pending elements are stored inline (no allocation),
+    // and at most max_pending can be pending at once. Last pushed is returned first.
+    static constexpr std::size_t max_pending = 4;
     void push_front(string_view element);
 
   private:
     // Reference to command line array
     int argc_;
     char const * const * argv_;
+    // Response files storage, optional
+    ResponseFiles * response_files_ = nullptr;
+    // Streaming source, replaces argc/argv if used
+    ArgumentSource * source_ = nullptr;
     // Iterating state
-    std::optional<string_view> current_element_;
+    std::array<string_view, max_pending> pending_;
+    std::size_t nb_pending_ = 0;
+    string_view response_file_remaining_; // Remaining text of the current response file
     int next_argument_ = 1;
+    std::size_t element_index_ = 0;
+    bool last_from_argv_ = false;
 };
 
 /******************************************************************************
@@ -178,12 +631,20 @@ class CommandLine {
  *   Performs parsing, exception on error.
  *   'name' is often taken as a string_view if NameType is a single CowStr (convertible).
  *
+ * bool try_parse(CommandLine & state, NameType const & name, ValueType & value, ParseError & e) :
+ *   Optional, same as parse without exceptions : returns false and fills e on error.
+ *   If absent, options use parse and convert exceptions to ErrorCode::Other.
+ *   Options require ValueType to be default constructible.
+ *
  * std::size_t write(std::string & buffer, ValueType const & value) :
  *   Writes a text representation of 'value' to the string buffer.
  *   Returns the size of the written text.
  *   Used for printing default values and in error messages.
  *   For small types the 'value' can be passed by value.
  *
+ * NameType default_name() :
+ *   Optional, initial value name of options (empty if absent). Choice<E> lists its choices.
+ *
  * Traits for basic types may expose a parse function from string_view.
  * This can be used to build user-specific parsers for complex cases.
  */
@@ -212,16 +673,31 @@ template <> struct ValueTrait<string_view> {
     static string_view parse(CommandLine & state, string_view name) {
         return state.next_value_or_fail(name);
     }
+    static bool
+    try_parse(CommandLine & state, string_view name, string_view & value, ParseError & error) {
+        return state.next_value(value, name, error);
+    }
+    // From text : identity, used by composite traits (List)
+    static string_view parse(string_view text, string_view) noexcept { return text; }
+    static bool
+    try_parse(string_view text, string_view, string_view & value, ParseError &) noexcept {
+        value = text;
+        return true;
+    }
     static std::size_t write(std::string & buffer, string_view value) {
         return write_text(buffer, value);
     }
 };
 
+/// Numbers : the whole text must be the number, as with strto<T> and base 0 (0x hexadecimal,
+/// 0 octal for integers). Unlike strto<T>, leading whitespace is rejected (' 42' is invalid).
 template <> struct ValueTrait<int> {
     using NameType = CowStr;
     using ValueType = int;
     static int parse(string_view text, string_view name);
     static int parse(CommandLine & state, string_view name);
+    static bool try_parse(string_view text, string_view name, int & value, ParseError & error);
+    static bool try_parse(CommandLine & state, string_view name, int & value, ParseError & error);
     static std::size_t write(std::string & buffer, int value);
 };
 template <> struct ValueTrait<long> {
@@ -229,6 +705,8 @@ template <> struct ValueTrait<long> {
     using ValueType = long;
     static long parse(string_view text, string_view name);
     static long parse(CommandLine & state, string_view name);
+    static bool try_parse(string_view text, string_view name, long & value, ParseError & error);
+    static bool try_parse(CommandLine & state, string_view name, long & value, ParseError & error);
     static std::size_t write(std::string & buffer, long value);
 };
 
@@ -237,6 +715,8 @@ template <> struct ValueTrait<float> {
     using ValueType = float;
     static float parse(string_view text, string_view name);
     static float parse(CommandLine & state, string_view name);
+    static bool try_parse(string_view text, string_view name, float & value, ParseError & error);
+    static bool try_parse(CommandLine & state, string_view name, float & value, ParseError & error);
     static std::size_t write(std::string & buffer, float value);
 };
 template <> struct ValueTrait<double> {
@@ -244,6 +724,9 @@ template <> struct ValueTrait<double> {
     using ValueType = double;
     static double parse(string_view text, string_view name);
     static double parse(CommandLine & state, string_view name);
+    static bool try_parse(string_view text, string_view name, double & value, ParseError & error);
+    static bool
+    try_parse(CommandLine & state, string_view name, double & value, ParseError & error);
     static std::size_t write(std::string & buffer, double value);
 };
 template <> struct ValueTrait<long double> {
@@ -251,9 +734,62 @@ template <> struct ValueTrait<long double> {
     using ValueType = long double;
     static long double parse(string_view text, string_view name);
     static long double parse(CommandLine & state, string_view name);
+    static bool
+    try_parse(string_view text, string_view name, long double & value, ParseError & error);
+    static bool
+    try_parse(CommandLine & state, string_view name, long double & value, ParseError & error);
     static std::size_t write(std::string & buffer, long double value);
 };
 
+/// Parse with ValueTrait<T>::try_parse, or with ValueTrait<T>::parse if the trait has no try_parse.
+template <typename T, typename = void> struct HasTryParse : std::false_type {};
+template <typename T>
+struct HasTryParse<
+    T,
+    std::void_t<decltype(ValueTrait<T>::try_parse(
+        std::declval<CommandLine &>(),
+        std::declval<typename ValueTrait<T>::NameType const &>(),
+        std::declval<typename ValueTrait<T>::ValueType &>(),
+        std::declval<ParseError &>()))>> : std::true_type {};
+
+template <typename T>
+bool try_parse_value(
+    CommandLine & state,
+    typename ValueTrait<T>::NameType const & name,
+    typename ValueTrait<T>::ValueType & value,
+    ParseError & error) {
+    if constexpr(HasTryParse<T>::value) {
+        return ValueTrait<T>::try_parse(state, name, value, error);
+    } else {
+#if ROPTS_EXCEPTIONS
+        try {
+            value = ValueTrait<T>::parse(state, name);
+            return true;
+        } catch(std::exception const & e) {
+            error.code = ErrorCode::Other;
+            error.other_message = e.what();
+            return false;
+        }
+#else
+        static_assert(HasTryParse<T>::value, "try_parse is required without exceptions");
+        return false;
+#endif
+    }
+}
+
+/// Initial value name of options : ValueTrait<T>::default_name() if present, else empty.
+template <typename T, typename = void> struct HasDefaultName : std::false_type {};
+template <typename T>
+struct HasDefaultName<T, std::void_t<decltype(ValueTrait<T>::default_name())>> : std::true_type {};
+
+template <typename T> typename ValueTrait<T>::NameType default_value_name() {
+    if constexpr(HasDefaultName<T>::value) {
+        return ValueTrait<T>::default_name();
+    } else {
+        return {};
+    }
+}
+
 template <typename... Types> struct ValueTrait<std::tuple<Types...>> {
     using NameType = std::array<CowStr, sizeof...(Types)>;
     using ValueType = std::tuple<typename ValueTrait<Types>::ValueType...>;
@@ -261,6 +797,11 @@ template <typename... Types> struct ValueTrait<std::tuple<Types...>> {
     static ValueType parse(CommandLine & state, NameType const & names) {
         return parse_impl(state, names, std::make_index_sequence<sizeof...(Types)>{});
     }
+    static bool
+    try_parse(CommandLine & state, NameType const & names, ValueType & value, ParseError & error) {
+        return try_parse_impl(
+            state, names, value, error, std::make_index_sequence<sizeof...(Types)>{});
+    }
 
   private:
     template <std::size_t... I>
@@ -268,6 +809,161 @@ template <typename... Types> struct ValueTrait<std::tuple<Types...>> {
     parse_impl(CommandLine & state, NameType const & names, std::index_sequence<I...>) {
         return {ValueTrait<Types>::parse(state, names[I])...};
     }
+    template <std::size_t... I>
+    static bool try_parse_impl(
+        CommandLine & state,
+        NameType const & names,
+        ValueType & value,
+        ParseError & error,
+        std::index_sequence<I...>) {
+        return (try_parse_value<Types>(state, names[I], std::get<I>(value), error) && ...);
+    }
+};
+
+/// Separated list of values in one element : '--ids 1,2,3' with ValueTrait<List<int>>.
+/// T must have a ValueTrait with try_parse(string_view text, ...).
+/// Pieces are string_view into the element, and the vector is sized by counting separators first.
+/// An empty element is an empty list.
+template <typename T, char Separator = ','> struct List {};
+
+template <typename T, char Separator> struct ValueTrait<List<T, Separator>> {
+    using NameType = CowStr;
+    using ValueType = std::vector<typename ValueTrait<T>::ValueType>;
+
+    static ValueType parse(string_view text, string_view name) {
+        ValueType values;
+        ParseError error;
+        if(!try_parse(text, name, values, error)) {
+            throw_exception(error.message());
+        }
+        return values;
+    }
+    static ValueType parse(CommandLine & state, string_view name) {
+        return parse(state.next_value_or_fail(name), name);
+    }
+    static bool
+    try_parse(string_view text, string_view name, ValueType & values, ParseError & error) {
+        values.clear();
+        if(text.empty()) {
+            return true;
+        }
+        values.reserve(std::size_t(std::count(text.begin(), text.end(), Separator)) + 1);
+        while(true) {
+            std::size_t separator = text.find(Separator);
+            values.emplace_back();
+            if(!ValueTrait<T>::try_parse(text.substr(0, separator), name, values.back(), error)) {
+                return false;
+            }
+            if(separator == string_view::npos) {
+                return true;
+            }
+            text.remove_prefix(separator + 1);
+        }
+    }
+    static bool
+    try_parse(CommandLine & state, string_view name, ValueType & values, ParseError & error) {
+        string_view text;
+        return state.next_value(text, name, error) && try_parse(text, name, values, error);
+    }
+    static std::size_t write(std::string & buffer, ValueType const & values) {
+        std::size_t size = 0;
+        for(std::size_t i = 0; i < values.size(); ++i) {
+            if(i > 0) {
+                size += write_text(buffer, Separator);
+            }
+            size += ValueTrait<T>::write(buffer, values[i]);
+        }
+        return size;
+    }
+};
+
+/// Enumeration value from a fixed set of names : '--mode fast' with ValueTrait<Choice<Mode>>.
+/// Names are declared by specializing ChoiceNames<E>, in the order of values 0 to N-1 :
+///   template <> struct ChoiceNames<Mode> {
+///       static constexpr auto table = make_name_table("fast", "safe", "debug");
+///   };
+/// Parsing is a StaticNameTable lookup, writing indexes the table by value.
+/// The default value name lists the choices ('{fast,safe,debug}'), built at compile time.
+template <typename E> struct ChoiceNames;
+template <typename E> struct Choice {};
+
+template <typename E> struct ValueTrait<Choice<E>> {
+    using NameType = CowStr;
+    using ValueType = E;
+
+    static NameType default_name() noexcept { return CowStr::borrowed(choices()); }
+    // "{fast,safe,debug}"
+    static constexpr string_view choices() noexcept {
+        return string_view(text_.data(), text_.size()).substr(type_prefix.size());
+    }
+
+    static E parse(string_view text, string_view name) {
+        E value{};
+        ParseError error;
+        if(!try_parse(text, name, value, error)) {
+            throw_exception(error.message());
+        }
+        return value;
+    }
+    static E parse(CommandLine & state, string_view name) {
+        return parse(state.next_value_or_fail(name), name);
+    }
+    static bool try_parse(string_view text, string_view name, E & value, ParseError & error) {
+        std::size_t index = table().find(text);
+        if(index == table().not_found) {
+            error.code = ErrorCode::InvalidValue;
+            error.text = text;
+            error.value_name = name;
+            // Do not repeat choices if they are the value name already
+            string_view type_name(text_.data(), text_.size());
+            bool listed = name == choices();
+            error.type_name = listed ? type_name.substr(0, type_prefix.size() - 1) : type_name;
+            return false;
+        }
+        value = static_cast<E>(index);
+        return true;
+    }
+    static bool try_parse(CommandLine & state, string_view name, E & value, ParseError & error) {
+        string_view text;
+        return state.next_value(text, name, error) && try_parse(text, name, value, error);
+    }
+    static std::size_t write(std::string & buffer, E value) {
+        auto index = static_cast<std::size_t>(value);
+        assert(index < table().size());
+        return write_text(buffer, table()[index]);
+    }
+
+  private:
+    static constexpr auto const & table() noexcept { return ChoiceNames<E>::table; }
+    static_assert(decltype(ChoiceNames<E>::table)::not_found > 0, "choices must not be empty");
+
+    // "choice {fast,safe,debug}" : type name in errors, with the choices as suffix
+    static constexpr string_view type_prefix = "choice ";
+    static constexpr std::size_t text_size() noexcept {
+        std::size_t size = type_prefix.size() + 2 + (table().size() - 1); // Braces, commas
+        for(std::size_t i = 0; i < table().size(); ++i) {
+            size += table()[i].size();
+        }
+        return size;
+    }
+    static constexpr std::array<char, text_size()> make_text() noexcept {
+        std::array<char, text_size()> text{};
+        std::size_t size = 0;
+        auto append = [&text, &size](string_view s) {
+            for(char c : s) {
+                text[size++] = c;
+            }
+        };
+        append(type_prefix);
+        append("{");
+        for(std::size_t i = 0; i < table().size(); ++i) {
+            append(i > 0 ? "," : "");
+            append(table()[i]);
+        }
+        append("}");
+        return text;
+    }
+    static constexpr std::array<char, text_size()> text_ = make_text();
 };
 
 // TODO print defaults.
@@ -276,6 +972,61 @@ template <typename... Types> struct ValueTrait<std::tuple<Types...>> {
  * Option types.
  */
 
+/// Names of an option, as a literal type for compile-time tables.
+struct OptionNames {
+    char short_name = '\0';
+    string_view long_name;
+};
+
+/// Storage of the result of one option for a const parse (see ParseResults).
+struct OptionResultBase {
+    virtual ~OptionResultBase() = default;
+    virtual std::unique_ptr<OptionResultBase> clone() const = 0;
+    // Rollback without copy (IncrementalParser) : results only appending values return their
+    // number of values, and truncate back to it. Others return no_mark, and are cloned.
+    static constexpr std::size_t no_mark = std::size_t(-1);
+    virtual std::size_t mark() const noexcept { return no_mark; }
+    virtual void truncate(std::size_t /*mark*/) {}
+    std::size_t nb_occurrences = 0;
+};
+template <typename T> struct IsVector : std::false_type {};
+template <typename T, typename Allocator>
+struct IsVector<std::vector<T, Allocator>> : std::true_type {};
+
+// Vector results are only appended to by parsing.
+template <typename T> struct OptionResult final : OptionResultBase {
+    T value{};
+
+    OptionResult() = default;
+    // Constructs value in place from args : an allocator for containers (pmr propagation).
+    template <typename... Args>
+    explicit OptionResult(std::in_place_t, Args &&... args) : value(std::forward<Args>(args)...) {}
+
+    std::unique_ptr<OptionResultBase> clone() const override {
+        if constexpr(IsVector<T>::value) {
+            // The copy constructor of a pmr vector would use the default resource
+            auto copy = std::make_unique<OptionResult>(std::in_place, value, value.get_allocator());
+            copy->nb_occurrences = nb_occurrences;
+            return copy;
+        } else {
+            return std::make_unique<OptionResult>(*this);
+        }
+    }
+    std::size_t mark() const noexcept override {
+        if constexpr(IsVector<T>::value) {
+            return value.size();
+        } else {
+            return no_mark;
+        }
+    }
+    void truncate(std::size_t mark) override {
+        if constexpr(IsVector<T>::value) {
+            assert(mark <= value.size());
+            value.erase(value.begin() + std::ptrdiff_t(mark), value.end());
+        }
+    }
+};
+
 // Base type for options, required by Application.
 class OptionBase {
   public:
@@ -291,6 +1042,13 @@ class OptionBase {
         assert(has_short_name());
         assert(has_long_name());
     }
+    /// From a compile-time table : long name is borrowed (static lifetime).
+    explicit OptionBase(OptionNames const & names) noexcept : short_name_(names.short_name) {
+        if(!names.long_name.empty()) {
+            long_name_ = CowStr::borrowed(names.long_name);
+        }
+        assert(has_short_name() || has_long_name());
+    }
 
     // Cannot be relocated (would invalidate registration)
     virtual ~OptionBase() = default;
@@ -308,36 +1066,122 @@ class OptionBase {
 
     std::size_t nb_occurrences() const noexcept { return nb_occurrences_; }
 
-    void parse(CommandLine & state) {
-        parse_impl(state);
+    /// Parse one occurrence, throw on error.
+    void parse(CommandLine & state);
+    /// Same as parse(), returning false and filling error on failure (error.option is this).
+    bool try_parse(CommandLine & state, ParseError & error) {
+        if(!parse_impl(state, error)) {
+            error.option = this;
+            return false;
+        }
         nb_occurrences_ += 1;
+        return true;
+    }
+    /// Same as try_parse(), with static dispatch when the option type is known.
+    template <typename Option>
+    static bool try_parse_static(Option & option, CommandLine & state, ParseError & error) {
+        static_assert(std::is_final<Option>::value, "dynamic type must be known");
+        if(!option.Option::parse_impl(state, error)) {
+            error.option = &option;
+            return false;
+        }
+        option.nb_occurrences_ += 1;
+        return true;
     }
 
     virtual Slice<CowStr> value_names() const = 0;
 
-  protected:
-    virtual void parse_impl(CommandLine & state) = 0;
+    /// Same as parse(), storing a result outside of the option (const, thread safe).
+    /// result must come from make_result() of the same option.
+    void parse(CommandLine & state, OptionResultBase & result) const;
+    bool try_parse(CommandLine & state, OptionResultBase & result, ParseError & error) const {
+        if(!parse_result_impl(state, result, error)) {
+            error.option = this;
+            return false;
+        }
+        result.nb_occurrences += 1;
+        return true;
+    }
+    virtual std::unique_ptr<OptionResultBase> make_result() const = 0;
+    /// Set result to the initial state : not parsed, with the current value of the option.
+    void reset(OptionResultBase & result) const {
+        reset_result_impl(result);
+        result.nb_occurrences = 0;
+    }
+
+    /// Hint that the option will be parsed nb_occurrences more times (preallocate storage).
+    virtual void reserve_occurrences(std::size_t /*nb_occurrences*/) {}
 
-    [[noreturn]] void fail_option_repeated() const;
-    [[noreturn]] void fail_parsing_error(string_view msg) const;
+  protected:
+    // Parsing implementation : return false and fill error on failure.
+    virtual bool parse_impl(CommandLine & state, ParseError & error) = 0;
+    virtual bool parse_result_impl(
+        CommandLine & state, OptionResultBase & result, ParseError & error) const = 0;
+    virtual void reset_result_impl(OptionResultBase & result) const = 0;
+
+    static bool fail_repeated(ParseError & error) noexcept {
+        error.code = ErrorCode::RepeatedOption;
+        return false;
+    }
+#if ROPTS_EXCEPTIONS
+    // Error for an exception from user code (callbacks)
+    static bool fail_exception(std::exception const & e, ParseError & error) {
+        error.code = ErrorCode::Other;
+        error.other_message = e.what();
+        return false;
+    }
+#endif
+
+    // Lazy options : append one element per value name to elements, unchanged on error.
+    bool record_value_elements(
+        CommandLine & state, std::pmr::vector<string_view> & elements, ParseError & error) const;
+    // Lazy options : convert recorded elements of one value, throw on error.
+    template <typename T>
+    typename ValueTrait<T>::ValueType convert_value_elements(
+        Slice<string_view> elements, typename ValueTrait<T>::NameType const & value_name) const {
+        SliceArgumentSource source{elements};
+        CommandLine command_line{source};
+        ParseError error;
+        typename ValueTrait<T>::ValueType value{};
+        if(!try_parse_value<T>(command_line, value_name, value, error)) {
+            error.option = this;
+            throw_exception(error.message());
+        }
+        return value;
+    }
 
   public:
     // Public properties
     CowStr help_text;
     CowStr doc_text;
+    CowStr env_name; // Environment variable used by Application::apply_fallbacks
 
   private:
     CowStr long_name_;
-    std::uint16_t nb_occurrences_ = 0;
+    std::uint32_t nb_occurrences_ = 0;
     char short_name_ = '\0'; // '\0' represent invalid
 };
 
 /// Flag that can be set once or more
 struct Flag final : OptionBase {
+    using OptionBase::OptionBase;
+
     bool value() const noexcept { return nb_occurrences() > 0; }
 
     Slice<CowStr> value_names() const override { return Slice<CowStr>{}; }
-    void parse_impl(CommandLine &) override {}
+    bool parse_impl(CommandLine &, ParseError &) override { return true; }
+
+    using Result = OptionResult<bool>;
+    std::unique_ptr<OptionResultBase> make_result() const override {
+        return std::make_unique<Result>();
+    }
+    bool parse_result_impl(CommandLine &, OptionResultBase & result, ParseError &) const override {
+        static_cast<Result &>(result).value = true;
+        return true;
+    }
+    void reset_result_impl(OptionResultBase & result) const override {
+        static_cast<Result &>(result).value = value();
+    }
 };
 
 /// Option with value of type T that can be set only once
@@ -347,47 +1191,260 @@ template <typename T> struct OptionSingle final : OptionBase {
 
     // Can be set to have a default value
     std::optional<typename ValueTrait<T>::ValueType> value;
-    typename ValueTrait<T>::NameType value_name;
+    typename ValueTrait<T>::NameType value_name = default_value_name<T>();
 
     Slice<CowStr> value_names() const override { return Slice<CowStr>{value_name}; }
 
-    void parse_impl(CommandLine & state) override {
-        if(nb_occurrences() > 0) {
-            fail_option_repeated();
+    bool parse_impl(CommandLine & state, ParseError & error) override {
+        return parse_value(state, value, nb_occurrences(), error);
+    }
+
+    using Result = OptionResult<std::optional<typename ValueTrait<T>::ValueType>>;
+    std::unique_ptr<OptionResultBase> make_result() const override {
+        return std::make_unique<Result>();
+    }
+    bool parse_result_impl(
+        CommandLine & state, OptionResultBase & result, ParseError & error) const override {
+        auto & typed = static_cast<Result &>(result);
+        return parse_value(state, typed.value, typed.nb_occurrences, error);
+    }
+    void reset_result_impl(OptionResultBase & result) const override {
+        static_cast<Result &>(result).value = value;
+    }
+
+  private:
+    bool parse_value(
+        CommandLine & state,
+        std::optional<typename ValueTrait<T>::ValueType> & destination,
+        std::size_t nb_occurrences,
+        ParseError & error) const {
+        if(nb_occurrences > 0) {
+            return fail_repeated(error);
         }
-        try {
-            value = ValueTrait<T>::parse(state, value_name);
-        } catch(std::exception const & e) {
-            fail_parsing_error(e.what());
+        typename ValueTrait<T>::ValueType parsed{};
+        if(!try_parse_value<T>(state, value_name, parsed, error)) {
+            return false;
         }
+        destination = std::move(parsed);
+        return true;
     }
 };
 
 /// Option that can be called multiple times, storing the results in a vector
-template <typename T> struct OptionMultiple final : OptionBase {
+template <typename T, typename Allocator = std::allocator<typename ValueTrait<T>::ValueType>>
+struct OptionMultiple final : OptionBase {
     // TODO min/max conditions ?
     using OptionBase::OptionBase;
 
-    std::vector<typename ValueTrait<T>::ValueType> values;
-    typename ValueTrait<T>::NameType value_name;
+    /// Use a specific allocator for values : {std::allocator_arg, allocator, names...}
+    template <typename... Names>
+    OptionMultiple(std::allocator_arg_t, Allocator const & allocator, Names &&... names)
+        : OptionBase(std::forward<Names>(names)...), values(allocator) {}
+
+    std::vector<typename ValueTrait<T>::ValueType, Allocator> values;
+    typename ValueTrait<T>::NameType value_name = default_value_name<T>();
+
+    // If set, parsed values are given to the callback instead of being stored in values.
+    // With an ArgumentSource, string_view values are only valid during the callback.
+    std::function<void(typename ValueTrait<T>::ValueType &&)> on_value;
 
     Slice<CowStr> value_names() const override { return Slice<CowStr>{value_name}; }
 
-    void parse_impl(CommandLine & state) override {
+    void reserve_occurrences(std::size_t nb_occurrences) override {
+        if(!on_value) {
+            values.reserve(values.size() + nb_occurrences);
+        }
+    }
+
+    bool parse_impl(CommandLine & state, ParseError & error) override {
+        if(!on_value) {
+            return push_value(state, values, error);
+        }
+        typename ValueTrait<T>::ValueType parsed{};
+        if(!try_parse_value<T>(state, value_name, parsed, error)) {
+            return false;
+        }
+#if ROPTS_EXCEPTIONS
         try {
-            values.push_back(ValueTrait<T>::parse(state, value_name));
+            on_value(std::move(parsed));
         } catch(std::exception const & e) {
-            fail_parsing_error(e.what());
+            return fail_exception(e, error);
+        }
+#else
+        on_value(std::move(parsed));
+#endif
+        return true;
+    }
+
+    // on_value is not used by const parsing : values are always stored in the result.
+    using Result = OptionResult<std::vector<typename ValueTrait<T>::ValueType, Allocator>>;
+    std::unique_ptr<OptionResultBase> make_result() const override {
+        return std::make_unique<Result>(std::in_place, values.get_allocator());
+    }
+    bool parse_result_impl(
+        CommandLine & state, OptionResultBase & result, ParseError & error) const override {
+        return push_value(state, static_cast<Result &>(result).value, error);
+    }
+    void reset_result_impl(OptionResultBase & result) const override {
+        auto & typed = static_cast<Result &>(result);
+        typed.value.assign(values.begin(), values.end()); // Keeps capacity
+    }
+
+  private:
+    bool push_value(CommandLine & state, decltype(values) & destination, ParseError & error) const {
+        typename ValueTrait<T>::ValueType parsed{};
+        if(!try_parse_value<T>(state, value_name, parsed, error)) {
+            return false;
+        }
+        ROPTS_INSTRUMENT(std::size_t capacity = destination.capacity());
+        destination.push_back(std::move(parsed));
+        ROPTS_INSTRUMENT(instrumentation().count_growth(capacity, destination.capacity()));
+        return true;
+    }
+};
+
+/// Same as OptionSingle, but parsing only records the value elements.
+/// Conversion happens on the first call to value() (memoized), which reports conversion errors.
+/// Elements are string_view into the command line, which must outlive the option.
+/// Not usable with an ArgumentSource whose elements are transient.
+template <typename T> struct OptionSingleLazy final : OptionBase {
+    using OptionBase::OptionBase;
+    using ValueType = typename ValueTrait<T>::ValueType;
+
+    /// Use a specific allocator for elements : {std::allocator_arg, allocator, names...}
+    template <typename... Names>
+    OptionSingleLazy(
+        std::allocator_arg_t,
+        std::pmr::polymorphic_allocator<string_view> const & allocator,
+        Names &&... names)
+        : OptionBase(std::forward<Names>(names)...), elements_(allocator) {}
+
+    // Returned by value() if the option is not used
+    std::optional<ValueType> default_value;
+    typename ValueTrait<T>::NameType value_name = default_value_name<T>();
+
+    Slice<CowStr> value_names() const override { return Slice<CowStr>{value_name}; }
+
+    /// Recorded elements, not converted
+    Slice<string_view> elements() const noexcept {
+        return Slice<string_view>{elements_.data(), elements_.size()};
+    }
+
+    std::optional<ValueType> const & value() const {
+        if(nb_occurrences() == 0) {
+            return default_value;
+        }
+        if(!value_) {
+            value_ = convert_value_elements<T>(elements(), value_name);
+        }
+        return value_;
+    }
+
+    bool parse_impl(CommandLine & state, ParseError & error) override {
+        if(nb_occurrences() > 0) {
+            return fail_repeated(error);
         }
+        return record_value_elements(state, elements_, error);
+    }
+
+    // Result of const parsing : recorded elements, not converted.
+    using Result = OptionResult<std::pmr::vector<string_view>>;
+    std::unique_ptr<OptionResultBase> make_result() const override {
+        return std::make_unique<Result>(std::in_place, elements_.get_allocator());
     }
+    bool parse_result_impl(
+        CommandLine & state, OptionResultBase & result, ParseError & error) const override {
+        if(result.nb_occurrences > 0) {
+            return fail_repeated(error);
+        }
+        return record_value_elements(state, static_cast<Result &>(result).value, error);
+    }
+    void reset_result_impl(OptionResultBase & result) const override {
+        static_cast<Result &>(result).value.assign(elements_.begin(), elements_.end());
+    }
+
+  private:
+    std::pmr::vector<string_view> elements_;
+    mutable std::optional<ValueType> value_;
 };
 
+/// Same as OptionMultiple, but parsing only records the value elements (see OptionSingleLazy).
+/// values() converts elements recorded since the last call, so it can be interleaved with parsing.
+template <typename T> struct OptionMultipleLazy final : OptionBase {
+    using OptionBase::OptionBase;
+    using ValueType = typename ValueTrait<T>::ValueType;
+
+    /// Use a specific allocator for elements : {std::allocator_arg, allocator, names...}
+    template <typename... Names>
+    OptionMultipleLazy(
+        std::allocator_arg_t,
+        std::pmr::polymorphic_allocator<string_view> const & allocator,
+        Names &&... names)
+        : OptionBase(std::forward<Names>(names)...), elements_(allocator) {}
+
+    typename ValueTrait<T>::NameType value_name = default_value_name<T>();
+
+    Slice<CowStr> value_names() const override { return Slice<CowStr>{value_name}; }
+
+    /// Recorded elements of all values, not converted : value_names().size elements per value.
+    Slice<string_view> elements() const noexcept {
+        return Slice<string_view>{elements_.data(), elements_.size()};
+    }
+
+    std::vector<ValueType> const & values() const {
+        std::size_t const elements_per_value = value_names().size;
+        assert(elements_per_value > 0);
+        values_.reserve(elements_.size() / elements_per_value);
+        while(values_.size() * elements_per_value < elements_.size()) {
+            Slice<string_view> value_elements{
+                elements_.data() + values_.size() * elements_per_value, elements_per_value};
+            values_.push_back(convert_value_elements<T>(value_elements, value_name));
+        }
+        return values_;
+    }
+
+    void reserve_occurrences(std::size_t nb_occurrences) override {
+        elements_.reserve(elements_.size() + nb_occurrences * value_names().size);
+    }
+
+    bool parse_impl(CommandLine & state, ParseError & error) override {
+        return record_value_elements(state, elements_, error);
+    }
+
+    // Result of const parsing : recorded elements, not converted.
+    using Result = OptionResult<std::pmr::vector<string_view>>;
+    std::unique_ptr<OptionResultBase> make_result() const override {
+        return std::make_unique<Result>(std::in_place, elements_.get_allocator());
+    }
+    bool parse_result_impl(
+        CommandLine & state, OptionResultBase & result, ParseError & error) const override {
+        return record_value_elements(state, static_cast<Result &>(result).value, error);
+    }
+    void reset_result_impl(OptionResultBase & result) const override {
+        static_cast<Result &>(result).value.assign(elements_.begin(), elements_.end());
+    }
+
+  private:
+    std::pmr::vector<string_view> elements_;
+    mutable std::vector<ValueType> values_;
+};
+
+namespace pmr {
+/// OptionMultiple with values allocated from a std::pmr::memory_resource.
+template <typename T>
+using OptionMultiple = ropts::OptionMultiple<
+    T,
+    std::pmr::polymorphic_allocator<typename ValueTrait<T>::ValueType>>;
+} // namespace pmr
+
 /******************************************************************************
  * Application.
  *
  * TODO intrusive lists ?
  */
 
+// Constraint on occurrences of a set of options, checked by Application::parse().
+// Options must also be registered in the Application.
 struct OptionGroup {
     enum class Constraint {
         None, // Just a group for usage.
@@ -396,34 +1453,910 @@ struct OptionGroup {
     };
 
     CowStr name;
-    std::vector<OptionBase *> options;
+    std::pmr::vector<OptionBase *> options;
     Constraint constraint = Constraint::None;
 };
 
+/******************************************************************************
+ * Positional elements, stored by an Application (see Application::set_positionals).
+ * Elements are views, in order. While they are consecutive argv elements (no option in between,
+ * or all after '--'), only a slice of argv is stored : no allocation, whatever the number.
+ * Otherwise they are copied as string_view to a vector.
+ */
+class Positionals {
+  public:
+    Positionals() noexcept = default;
+    explicit Positionals(CowStr value_name_) noexcept : value_name(std::move(value_name_)) {}
+    // Elements (if not consecutive in argv) are allocated from resource.
+    explicit Positionals(std::pmr::memory_resource * resource) noexcept : elements_(resource) {}
+    Positionals(CowStr value_name_, std::pmr::memory_resource * resource) noexcept
+        : value_name(std::move(value_name_)), elements_(resource) {}
+
+    std::size_t size() const noexcept { return argv_.size + elements_.size(); }
+    bool empty() const noexcept { return size() == 0; }
+    string_view operator[](std::size_t i) const noexcept {
+        return argv_.size > 0 ? string_view{argv_[i]} : elements_[i];
+    }
+    /// True if elements are stored as argv_slice().
+    bool is_argv_slice() const noexcept { return elements_.empty(); }
+    /// Consecutive argv elements, if is_argv_slice() : can be passed as argv to a child process.
+    Slice<char const *> argv_slice() const noexcept { return argv_; }
+
+    class Iterator {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = string_view;
+
+        Iterator(Positionals const & positionals, std::size_t index) noexcept
+            : positionals_(&positionals), index_(index) {}
+        string_view operator*() const noexcept { return (*positionals_)[index_]; }
+        Iterator & operator++() noexcept {
+            index_ += 1;
+            return *this;
+        }
+        bool operator==(Iterator const & other) const noexcept { return index_ == other.index_; }
+        bool operator!=(Iterator const & other) const noexcept { return index_ != other.index_; }
+
+      private:
+        Positionals const * positionals_;
+        std::size_t index_;
+    };
+    Iterator begin() const noexcept { return {*this, 0}; }
+    Iterator end() const noexcept { return {*this, size()}; }
+
+    void clear() noexcept {
+        argv_ = {};
+        elements_.clear();
+    }
+    /// Keep the first size elements.
+    void truncate(std::size_t size) noexcept {
+        if(argv_.size > size) {
+            argv_.size = size;
+        } else if(elements_.size() > size) {
+            elements_.resize(size);
+        }
+    }
+    /// Add an element. argv_element is its position in argv, or nullptr.
+    void add(string_view element, char const * const * argv_element);
+    /// Add consecutive argv elements.
+    void add(Slice<char const *> argv_elements);
+
+    /// Shown in usage as 'value_name...'
+    CowStr value_name = "ARGS";
+
+  private:
+    Slice<char const *> argv_;
+    std::pmr::vector<string_view> elements_; // All elements, if not consecutive in argv
+};
+
+/******************************************************************************
+ * Parsing loop, shared by Application and StaticApplication.
+ *
+ * Registry must provide (options are referred to by an id) :
+ * - std::size_t find_short(char name) : id, or no_option.
+ * - std::size_t find_long(string_view name) : id, or no_option.
+ * - bool takes_value(std::size_t id) : true if the option consumes value elements.
+ * - bool parse_option(std::size_t id, CommandLine & state, ParseError & error) : false on error.
+ * - bool parse_positional(string_view element, bool after_separator, CommandLine & state,
+ *   ParseError & error) : called for elements which are not options, false on error.
+ *   after_separator is true for elements after '--'.
+ *   Registries without positionals use fail_unexpected_positional.
+ *
+ * Accepted forms : '--name', '--name=value', '-c', packed '-abc', and '-fVALUE' if f takes a
+ * value. Values split from an element are string_view into it, fed through push_front.
+ * Returns false and fills error on failure.
+ */
+constexpr std::size_t no_option = std::size_t(-1);
+
+inline bool fail_unexpected_positional(string_view element, ParseError & error) noexcept {
+    error.code = ErrorCode::UnexpectedPositional;
+    error.text = element;
+    return false;
+}
+
+/// One step of try_parse_options : parse element, extracted from command_line.
+/// enable_option_parsing is the parsing state, set to false by '--'.
+template <typename Registry>
+bool try_parse_element(
+    Registry & registry,
+    string_view element,
+    CommandLine & command_line,
+    bool & enable_option_parsing,
+    ParseError & error) {
+    bool ok = true;
+    if(enable_option_parsing && element.size() >= 2 && element[0] == '-' && element[1] == '-') {
+        // Long option
+        string_view option_name = element.substr(2);
+        if(option_name.empty()) {
+            // '--'
+            enable_option_parsing = false;
+        } else {
+            // '--name' or '--name=value'
+            std::size_t equal = option_name.find('=');
+            string_view name = option_name.substr(0, equal);
+            std::size_t option = registry.find_long(name);
+            if(option == no_option) {
+                error.code = ErrorCode::UnknownOption;
+                error.text = element;
+                error.name = name;
+                ok = false;
+            } else if(equal != string_view::npos && !registry.takes_value(option)) {
+                error.code = ErrorCode::UnexpectedValue;
+                error.text = element;
+                ok = false;
+            } else {
+                if(equal != string_view::npos) {
+                    command_line.push_front(option_name.substr(equal + 1));
+                }
+                ok = registry.parse_option(option, command_line, error);
+            }
+        }
+    } else if(enable_option_parsing && element.size() >= 2 && element[0] == '-') {
+        // Short options : '-c', packed '-abc', '-fVALUE'
+        for(std::size_t i = 1; ok && i < element.size(); ++i) {
+            std::size_t option = registry.find_short(element[i]);
+            if(option == no_option) {
+                error.code = ErrorCode::UnknownOption;
+                error.text = element;
+                error.name = element.substr(i, 1);
+                ok = false;
+            } else if(i + 1 < element.size() && registry.takes_value(option)) {
+                // Rest of the element is the value
+                command_line.push_front(element.substr(i + 1));
+                ok = registry.parse_option(option, command_line, error);
+                break;
+            } else {
+                ok = registry.parse_option(option, command_line, error);
+            }
+        }
+    } else {
+        // Positional or subcommand
+        ok = registry.parse_positional(element, !enable_option_parsing, command_line, error);
+    }
+    return ok;
+}
+
+template <typename Registry>
+bool try_parse_options(Registry & registry, CommandLine & command_line, ParseError & error) {
+    error = ParseError{}; // May be reused from a failed parse
+    bool enable_option_parsing = true; // Set to false if '--' is encountered.
+
+    while(std::optional<string_view> element = command_line.next(error)) {
+        if(!try_parse_element(registry, *element, command_line, enable_option_parsing, error)) {
+            error.element_index = command_line.element_index();
+            return false;
+        }
+    }
+    if(error) {
+        // Reading the command line failed
+        error.element_index = command_line.element_index();
+        return false;
+    }
+    return true;
+}
+
+/// Print usage for a list of options.
+void write_usage(std::FILE * out, string_view application_name, Slice<OptionBase const *> options);
+void write_usage(
+    std::ostream & out, string_view application_name, Slice<OptionBase const *> options);
+
+class Application;
+class ConfigValues;
+
+/******************************************************************************
+ * Results of a const parse, using an Application as an immutable schema.
+ * Created by Application::make_results(), and reused by successive parses.
+ * Options are not modified : values are read with get(option).
+ */
+class ParseResults {
+  public:
+    std::size_t nb_occurrences(OptionBase const & option) const {
+        return result(option).nb_occurrences;
+    }
+    /// Value stored by option, of type Option::Result::value (std::optional<T> for OptionSingle).
+    template <typename Option> auto const & get(Option const & option) const {
+        return static_cast<typename Option::Result const &>(result(option)).value;
+    }
+    /// Positional elements, if the Application has set_positionals.
+    Positionals const & positionals() const noexcept { return positionals_; }
+
+  private:
+    friend class Application;
+    friend class IncrementalParser;
+    // Storage is allocated from resource (the Application one).
+    ParseResults(Application const & application, std::pmr::memory_resource * resource) noexcept
+        : application_(&application),
+          results_(resource),
+          positionals_(resource),
+          occurrence_bits_(resource) {}
+
+    OptionResultBase const & result(OptionBase const & option) const;
+
+    Application const * application_;
+    std::pmr::vector<std::unique_ptr<OptionResultBase>> results_; // Same order as options_
+    Positionals positionals_;
+    std::pmr::vector<std::uint64_t> occurrence_bits_;
+};
+
 // Template versions of Optionbase interface will register in a parser.
 // They must outlive the parser itself.
 // The parser will fill them with values from the parsing step
 class Application {
   public:
-    Application(CowStr name) : name_(std::move(name)) {}
-
-    void add(OptionBase & option) { options_.emplace_back(&option); }
+    // Internal storage is allocated from resource.
+    Application(
+        CowStr name, std::pmr::memory_resource * resource = std::pmr::get_default_resource())
+        : name_(std::move(name)),
+          options_(resource),
+          groups_(resource),
+          long_name_index_(resource),
+          address_index_(resource),
+          group_words_(resource),
+          group_ends_(resource),
+          occurrence_bits_(resource),
+          usage_cache_(resource),
+          prescan_counts_(resource),
+          subcommands_(resource),
+          subcommand_index_(resource) {}
+
+    std::pmr::memory_resource * resource() const noexcept {
+        return options_.get_allocator().resource();
+    }
+    string_view name() const noexcept { return name_; }
+
+    void add(OptionBase & option) {
+        ROPTS_INSTRUMENT(std::size_t capacity = options_.capacity());
+        options_.emplace_back(&option);
+        ROPTS_INSTRUMENT(instrumentation().count_growth(capacity, options_.capacity()));
+        index_is_valid_ = false;
+        invalidate_usage();
+    }
+    // Registers options in order, with at most one allocation.
+    void add(std::initializer_list<OptionBase *> options) {
+        reserve(options_.size() + options.size());
+        for(OptionBase * option : options) {
+            assert(option != nullptr);
+            add(*option);
+        }
+    }
+    // Reserves storage for nb_options registered options, to register them without reallocation.
+    void reserve(std::size_t nb_options) {
+        ROPTS_INSTRUMENT(std::size_t capacity = options_.capacity());
+        options_.reserve(nb_options);
+        ROPTS_INSTRUMENT(instrumentation().count_growth(capacity, options_.capacity()));
+    }
+    // Group options must be registered, and the group not modified after parsing.
+    void add(OptionGroup & group) {
+        groups_.emplace_back(&group);
+        index_is_valid_ = false;
+    }
 
     // Parse command_line and fills registered options.
+    // Group constraints are checked after a successful parse.
     void parse(CommandLine command_line);
+    // Same as parse(), returning false and filling error instead of throwing an Exception.
+    bool try_parse(CommandLine command_line, ParseError & error);
+
+    // Positional elements of the next parses are stored to positionals, cleared by each parse.
+    // Without Positionals, a positional element is an error (ErrorCode::UnexpectedPositional).
+    void set_positionals(Positionals & positionals) noexcept {
+        positionals_ = &positionals;
+        invalidate_usage();
+    }
 
+    // Subcommands : a first positional element equal to name selects the subcommand, and the
+    // following elements are parsed by its own Application, named "<application> <name>".
+    // setup registers its options, and runs on first selection only : unselected subcommands
+    // cost their name and setup function. Subcommands are not supported by const parsing.
+    void add_subcommand(CowStr name, std::function<void(Application &)> setup);
+    // Application of the subcommand selected by the last parse, or nullptr.
+    Application * selected_subcommand() const noexcept { return selected_subcommand_; }
+
+    // Fallback values, applied after parse() : options without occurrence take their value from
+    // the environment variable env_name if it is set and not empty, else from config entries.
+    // Fallback values count as occurrences. Options without value are set by any value except
+    // "0" and "false". Values from the environment are split on spaces, and are views into it.
+    // Group constraints are checked by parse() on command line occurrences, then again at the end
+    // of apply_fallbacks() with fallback values included.
+    void apply_fallbacks(ConfigValues const * config = nullptr);
+    bool try_apply_fallbacks(ConfigValues const * config, ParseError & error);
+
+    // Hash of option names and number of value elements, in registration order.
+    // Identifies the options a ConfigValues snapshot was built for.
+    std::uint64_t schema_hash() const noexcept;
+
+    // If enabled, parse() first counts option occurrences in the command line, and reserves
+    // storage of options accordingly (OptionMultiple values are allocated once).
+    // Costs an additional name lookup per option element.
+    void enable_prescan(bool enable = true) noexcept { prescan_ = enable; }
+
+    // If enabled, parse() does not check group constraints : they are only checked by
+    // apply_fallbacks(), which must then follow. Required groups may be satisfied by fallbacks.
+    void defer_group_checks(bool defer = true) noexcept { defer_group_checks_ = defer; }
+
+    // Usage text is rendered on first use and cached, then written with a single write call.
+    // The cache is invalidated by add(), or manually if option texts are modified.
+    string_view usage() const;
     void write_usage(std::FILE * out) const;
     void write_usage(std::ostream & out) const;
+    void invalidate_usage() noexcept { usage_cache_.clear(); }
+
+    // Shell completion of a partial command line element.
+    // "--prefix" returns long names starting with prefix, in name order.
+    // "" or "-" returns all options : long form if available, then short only options.
+    // "-c" returns the short option 'c' if it exists.
+    struct Completion {
+        OptionBase const * option;
+        string_view dashes; // "-" or "--"
+        string_view name;
+    };
+    std::vector<Completion> complete(string_view partial) const;
+    // Write completions, one per line.
+    void write_completions(std::FILE * out, string_view partial) const;
+    void write_completions(std::ostream & out, string_view partial) const;
+
+    // Elements of argv used by occurrences of the selected options, in order, with their values.
+    // Returned pointers are argv elements (no copy), to build the argv of a child process.
+    // argv is re-scanned with the same rules as parse(), except that response files are not
+    // expanded : elements after '--' and positionals are not forwarded.
+    // A packed element ('-abc', '-fVALUE') is forwarded whole : its options must be all selected
+    // or all unselected, or an Exception is thrown.
+    std::vector<char const *>
+    forward(int argc, char const * const * argv, Slice<OptionBase const *> selected) const;
+
+    // Const parsing : the Application and options are an immutable schema, and values are stored
+    // in a ParseResults. Concurrent const parses are thread safe if the Application is not
+    // modified and the name index is built : make_results() builds it, so call it before
+    // sharing the Application. Response files and ArgumentSource must not be shared.
+    // usage() renders its cache on first call, and complete() builds the index : not thread safe
+    // until done once. parse_batch does both before starting threads, for use in on_parsed.
+    ParseResults make_results() const;
+    void parse(CommandLine command_line, ParseResults & results) const;
+    bool try_parse(CommandLine command_line, ParseResults & results, ParseError & error) const;
+
+    // Parse command_lines with nb_threads workers (0 : hardware concurrency).
+    // on_parsed(index, results, error) is called from workers, once per command line.
+    // error is null on success, else results are partial. Both are valid during the call.
+    // Exceptions (from on_parsed, or allocation failures) stop the batch and are rethrown.
+    using BatchCallback = std::function<void(
+        std::size_t index, ParseResults const & results, ParseError const * error)>;
+    void parse_batch(
+        Slice<CommandLine> command_lines,
+        BatchCallback const & on_parsed,
+        unsigned nb_threads = 0) const;
+
+  private:
+    CowStr name_;
+    std::pmr::vector<OptionBase *> options_;
+    std::pmr::vector<OptionGroup *> groups_;
+
+    template <typename Registry>
+    friend bool try_parse_options(Registry &, CommandLine &, ParseError &);
+    template <typename Registry>
+    friend bool try_parse_element(Registry &, string_view, CommandLine &, bool &, ParseError &);
+
+    // Name lookup index, built lazily on first use and invalidated by add().
+    // Values are indexes in options_, used as ids for try_parse_options.
+    // key packs the first 8 bytes of name (big endian, zero padded) : integer order on keys is
+    // name order, so most comparisons are a single integer comparison.
+    struct LongNameEntry {
+        std::uint64_t key;
+        string_view name;
+        std::uint32_t option;
+    };
+    static constexpr std::uint32_t no_option_index = UINT32_MAX;
+    mutable std::array<std::uint32_t, 256> short_name_index_;
+    mutable std::pmr::vector<LongNameEntry> long_name_index_; // Sorted by name
+    mutable std::pmr::vector<std::uint32_t> address_index_;    // Sorted by option address
+    mutable bool index_is_valid_ = false;
+
+    // Group constraints, checked with occurrence bits : bit i is set if options_[i] occurred.
+    // A group is a list of (word, mask) over the bits, by increasing word.
+    struct GroupWord {
+        std::uint32_t word;
+        std::uint64_t mask;
+    };
+    mutable std::pmr::vector<GroupWord> group_words_;
+    mutable std::pmr::vector<std::uint32_t> group_ends_; // End of each group in group_words_
+    mutable std::pmr::vector<std::uint64_t> occurrence_bits_; // Sized by build_index
+    std::size_t nb_occurrence_words() const noexcept { return (options_.size() + 63) / 64; }
+    static void set_occurrence(std::uint64_t * bits, std::size_t id) noexcept {
+        bits[id / 64] |= std::uint64_t(1) << (id % 64);
+    }
+    bool check_groups(std::uint64_t const * occurrence_bits, ParseError & error) const;
+
+    mutable std::pmr::string usage_cache_; // Empty if invalid
+
+    friend class ConfigValues;
+    friend class IncrementalParser;
+
+    // Prescan state, counts are reused between parse() calls.
+    bool prescan_ = false;
+    std::pmr::vector<std::uint32_t> prescan_counts_;
+    bool defer_group_checks_ = false;
+
+    void build_index() const;
+    void ensure_index() const {
+        if(!index_is_valid_) {
+            build_index();
+        }
+    }
+    void prescan(CommandLine command_line);
+    std::size_t find_short(char name) const noexcept;
+    std::size_t find_long(string_view name) const noexcept;
+    bool takes_value(std::size_t id) const noexcept { return options_[id]->value_names().size > 0; }
+    bool parse_option(std::size_t id, CommandLine & state, ParseError & error) {
+        set_occurrence(occurrence_bits_.data(), id);
+        return options_[id]->try_parse(state, error);
+    }
+    bool parse_positional(
+        string_view element, bool after_separator, CommandLine & state, ParseError & error);
+    // Parse the rest of command_line, after a subcommand name
+    bool try_parse_remaining(CommandLine & command_line, ParseError & error);
+
+    friend class ParseResults;
+    std::size_t option_index(OptionBase const & option) const noexcept;
+
+    // try_parse_options registry for const parsing
+    struct ResultsRegistry {
+        Application const & application;
+        ParseResults & results;
+
+        std::size_t find_short(char name) const noexcept { return application.find_short(name); }
+        std::size_t find_long(string_view name) const noexcept {
+            return application.find_long(name);
+        }
+        bool takes_value(std::size_t id) const noexcept { return application.takes_value(id); }
+        bool parse_option(std::size_t id, CommandLine & state, ParseError & error) {
+            set_occurrence(results.occurrence_bits_.data(), id);
+            return application.options_[id]->try_parse(state, *results.results_[id], error);
+        }
+        bool parse_positional(
+            string_view element, bool after_separator, CommandLine & state, ParseError & error);
+    };
+
+    // Subcommands, with stable addresses for the index. Applications are created on selection.
+    // A list, as an empty deque allocates : it would be a startup cost without subcommands.
+    struct Subcommand {
+        CowStr name;
+        std::function<void(Application &)> setup;
+        std::unique_ptr<Application> application;
+    };
+    std::pmr::list<Subcommand> subcommands_;
+    std::pmr::unordered_map<string_view, Subcommand *> subcommand_index_;
+    Application * selected_subcommand_ = nullptr;
+
+    Positionals * positionals_ = nullptr;
+};
+
+/******************************************************************************
+ * ConfigValues : option values from a configuration, see Application::apply_fallbacks.
+ *
+ * Text format, one option per line : 'name = value elements', with the long name of the option.
+ * Elements are separated by spaces. Lines starting with '#' and empty lines are ignored.
+ * Options without value can be written 'name' only. Names can be repeated (OptionMultiple).
+ *
+ * Loaded values are stored in a compact binary form, which can be saved as a snapshot file.
+ * Loading a snapshot maps the file and checks it : no tokenization, and no name lookup.
+ * Without mmap (not POSIX), the snapshot is read into memory with stdio instead.
+ * Values are still converted by ValueTrait when applied, as value types have no binary form.
+ * A snapshot is tied to the Application schema_hash(), and to the machine (native endianness).
+ */
+class ConfigValues {
+  public:
+    ConfigValues() = default;
+
+    // Cannot be relocated (applied values are views into it)
+    ConfigValues(ConfigValues const &) = delete;
+    ConfigValues(ConfigValues &&) = delete;
+    ConfigValues & operator=(ConfigValues const &) = delete;
+    ConfigValues & operator=(ConfigValues &&) = delete;
+
+    // Loading replaces previous values. Returns false and fills error on failure.
+    // A successful load replaces the binary form built from text : string_view values applied
+    // from it by apply_fallbacks() dangle, and must be applied again. Mapped files stay alive.
+    bool try_load_text(Application const & application, string_view text, ParseError & error);
+    bool try_load_file(Application const & application, string_view path, ParseError & error);
+    bool
+    try_load_snapshot(Application const & application, string_view path, ParseError & error);
+    bool try_save_snapshot(string_view path, ParseError & error) const;
+
+    /// Number of option entries (lines of the text format)
+    std::size_t nb_entries() const noexcept { return nb_entries_; }
+
+  private:
+    friend class Application;
+    bool try_apply(
+        Application & application, std::vector<bool> const & skip, ParseError & error) const;
+
+    ResponseFiles files_;        // Mapped text and snapshot files
+    std::string built_;          // Binary form built from text
+    string_view data_;           // Binary form : built_, or a mapped snapshot
+    std::uint32_t nb_entries_ = 0;
+    std::uint32_t nb_elements_ = 0;
+};
+
+/******************************************************************************
+ * IncrementalParser : const parse of a command line given element by element, for interactive
+ * front-ends. Appending an element parses it only, and truncate() rolls back to a previous size,
+ * for edited elements : the cost is proportional to the change, not to the command line length.
+ *
+ * Elements are copied. An option waiting for values (--name without its value yet) is incomplete :
+ * its elements are kept, and parsed again when the next elements are appended.
+ * Rollback records the option results changed by each element, cloned before the change.
+ */
+class IncrementalParser {
+  public:
+    explicit IncrementalParser(Application const & application);
+
+    // Append and parse an element. On error, the element is rejected : state is unchanged.
+    bool append(string_view element, ParseError & error);
+    // Keep the first size elements, rolling back the state after them.
+    void truncate(std::size_t size);
+
+    /// Number of elements, including incomplete ones (usable as a checkpoint for truncate()).
+    std::size_t size() const noexcept { return elements_.size(); }
+    /// True if the last option is not waiting for values.
+    bool is_complete() const noexcept { return nb_parsed_ == elements_.size(); }
+    /// Values of parsed elements. Incomplete elements are not included.
+    ParseResults const & results() const noexcept { return results_; }
+    /// Final checks, as Application::try_parse : complete, and group constraints.
+    bool try_finish(ParseError & error) const;
+
+  private:
+    struct Registry;
+    // Changes of one step of the parsing loop : elements [first_element, end_element).
+    struct Step {
+        std::size_t first_element;
+        std::size_t end_element;
+        std::size_t first_undo;      // In undo_
+        std::size_t nb_positionals;  // Before the step
+        bool enable_option_parsing;  // Before the step
+    };
+    // State of an option result before the step : a mark if the result has one, else a copy.
+    struct Undo {
+        std::size_t option;
+        std::unique_ptr<OptionResultBase> result; // Null if mark is used
+        std::size_t mark;
+        std::size_t nb_occurrences;
+        bool occurred; // Occurrence bit
+    };
+
+    Application const & application_;
+    ParseResults results_;
+    std::deque<std::string> elements_; // Stable addresses : results contain views
+    std::size_t nb_parsed_ = 0;        // Elements in steps_, the others are incomplete
+    std::vector<Step> steps_;
+    std::vector<Undo> undo_;
+    bool enable_option_parsing_ = true;
+    ParseError incomplete_error_; // MissingValue error of incomplete elements
+
+    // Parse elements after nb_parsed_. False on error, which is rolled back (not incomplete).
+    bool resume(ParseError & error);
+    void undo_steps(std::size_t nb_steps);
+};
+
+/******************************************************************************
+ * Options declared at compile time.
+ *
+ * StaticOptionTable<N> holds option names, with constexpr lookup structures.
+ * It must be declared constexpr, and outlive the StaticApplication using it.
+ *
+ * StaticApplication<Options...> stores the options by value (final option types),
+ * and dispatches parsing statically : no registration allocation, no virtual calls.
+ *
+ * static constexpr auto table = make_option_table(OptionNames{'f', "factor"}, OptionNames{'v'});
+ * StaticApplication<OptionSingle<int>, Flag> app{"name", table};
+ * app.get<0>().value_name = "N";
+ */
+template <std::size_t N> class StaticOptionTable {
+  public:
+    constexpr explicit StaticOptionTable(std::array<OptionNames, N> const & options)
+        : options_(options), long_names_(long_names_of(options)) {
+        for(std::size_t i = 0; i < N; ++i) {
+            if(options[i].short_name != '\0') {
+                std::uint32_t & slot =
+                    short_names_[static_cast<unsigned char>(options[i].short_name)];
+                if(slot != N) {
+                    fail_duplicate_name(string_view(&options[i].short_name, 1));
+                }
+                slot = static_cast<std::uint32_t>(i);
+            }
+        }
+    }
+
+    /// Return index of option with name, or no_option.
+    constexpr std::size_t find_short(char name) const noexcept {
+        std::uint32_t i = short_names_[static_cast<unsigned char>(name)];
+        return i != N ? i : no_option;
+    }
+    constexpr std::size_t find_long(string_view name) const noexcept {
+        std::size_t i = long_names_.find(name);
+        return i != long_names_.not_found ? i : no_option;
+    }
+
+    constexpr OptionNames const & operator[](std::size_t i) const noexcept { return options_[i]; }
+    constexpr std::size_t size() const noexcept { return N; }
+
+  private:
+    std::array<OptionNames, N> options_;
+    StaticNameTable<N> long_names_;
+    std::array<std::uint32_t, 256> short_names_ = make_empty_short_names();
+
+    static constexpr std::array<string_view, N>
+    long_names_of(std::array<OptionNames, N> const & options) noexcept {
+        std::array<string_view, N> names{};
+        for(std::size_t i = 0; i < N; ++i) {
+            names[i] = options[i].long_name;
+        }
+        return names;
+    }
+    static constexpr std::array<std::uint32_t, 256> make_empty_short_names() noexcept {
+        std::array<std::uint32_t, 256> names{};
+        for(std::size_t i = 0; i < 256; ++i) {
+            names[i] = N;
+        }
+        return names;
+    }
+};
+
+template <typename... Names>
+constexpr StaticOptionTable<sizeof...(Names)> make_option_table(Names... options) {
+    return StaticOptionTable<sizeof...(Names)>{{OptionNames(options)...}};
+}
+
+template <typename... Options> class StaticApplication {
+  public:
+    static constexpr std::size_t nb_options = sizeof...(Options);
+    using Table = StaticOptionTable<nb_options>;
+
+    StaticApplication(CowStr name, Table const & table)
+        : StaticApplication(std::move(name), table, std::index_sequence_for<Options...>{}) {}
+
+    /// Access options by index in the table
+    template <std::size_t I> auto & get() noexcept { return std::get<I>(options_); }
+    template <std::size_t I> auto const & get() const noexcept { return std::get<I>(options_); }
+
+    // Parse command_line and fills options.
+    void parse(CommandLine command_line) {
+        ParseError error;
+        if(!try_parse(command_line, error)) {
+            throw_exception(error.message());
+        }
+    }
+    bool try_parse(CommandLine command_line, ParseError & error) {
+        return try_parse_options(*this, command_line, error);
+    }
+
+    void write_usage(std::FILE * out) const {
+        write_usage_impl(out, std::index_sequence_for<Options...>{});
+    }
+    void write_usage(std::ostream & out) const {
+        write_usage_impl(out, std::index_sequence_for<Options...>{});
+    }
 
   private:
     CowStr name_;
-    std::vector<OptionBase *> options_;
-    std::vector<OptionGroup *> groups_;
+    Table const & table_;
+    std::tuple<Options...> options_;
+
+    template <std::size_t... I>
+    StaticApplication(CowStr name, Table const & table, std::index_sequence<I...>)
+        : name_(std::move(name)), table_(table), options_(table[I]...) {}
+
+    template <typename Registry>
+    friend bool try_parse_options(Registry &, CommandLine &, ParseError &);
+    template <typename Registry>
+    friend bool try_parse_element(Registry &, string_view, CommandLine &, bool &, ParseError &);
+    std::size_t find_short(char name) const noexcept {
+        ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+        return table_.find_short(name);
+    }
+    std::size_t find_long(string_view name) const noexcept {
+        ROPTS_INSTRUMENT(instrumentation().nb_lookups += 1);
+        return table_.find_long(name);
+    }
+    bool takes_value(std::size_t id) const noexcept {
+        return takes_value_impl(id, std::index_sequence_for<Options...>{});
+    }
+    template <std::size_t... I>
+    bool takes_value_impl(std::size_t id, std::index_sequence<I...>) const noexcept {
+        return ((id == I && std::get<I>(options_).value_names().size > 0) || ...);
+    }
+    bool parse_option(std::size_t id, CommandLine & state, ParseError & error) {
+        return parse_option_impl(id, state, error, std::index_sequence_for<Options...>{});
+    }
+    template <std::size_t... I>
+    bool parse_option_impl(
+        std::size_t id, CommandLine & state, ParseError & error, std::index_sequence<I...>) {
+        // Chain of comparisons on constants, compiled like a switch.
+        bool ok = false;
+        bool found =
+            ((id == I ? (ok = OptionBase::try_parse_static(std::get<I>(options_), state, error),
+                         true)
+                      : false) ||
+             ...);
+        assert(found);
+        (void)found;
+        return ok;
+    }
+    bool parse_positional(string_view element, bool, CommandLine &, ParseError & error) noexcept {
+        return fail_unexpected_positional(element, error);
+    }
+
+    template <typename Output, std::size_t... I>
+    void write_usage_impl(Output & out, std::index_sequence<I...>) const {
+        std::array<OptionBase const *, nb_options> options{{&std::get<I>(options_)...}};
+        ropts::write_usage(out, name_, Slice<OptionBase const *>{options});
+    }
+};
+
+/******************************************************************************
+ * OptionTable : alternative to Application where options and their values live in the table.
+ *
+ * Storage is a struct of arrays : short names, long names (in a single buffer, with a sorted
+ * index), occurrence counters and parse functions are contiguous, and parsing dispatches through
+ * a function pointer (no virtual call, no pointer chasing to option objects).
+ * Options are referred to by handles (indexes) : the table owns everything and can be moved.
+ */
+class OptionTable {
+  public:
+    struct FlagHandle {
+        std::uint32_t index;
+    };
+    template <typename T> struct SingleHandle {
+        std::uint32_t index;
+    };
+    template <typename T> struct MultipleHandle {
+        std::uint32_t index;
+    };
+
+    OptionTable() noexcept { short_name_index_.fill(no_option_index); }
+
+    // Names are copied. Same constraints as Application : at least one name, and unique names.
+    FlagHandle add_flag(OptionNames const & names) {
+        return FlagHandle{add_option(names, 0, nullptr, Slot())};
+    }
+    template <typename T>
+    SingleHandle<T>
+    add_single(OptionNames const & names, typename ValueTrait<T>::NameType value_name) {
+        auto slot = make_slot(SingleSlot<T>{std::move(value_name), std::nullopt});
+        std::size_t nb_value_elements = Slice<CowStr>{slot_of<SingleSlot<T>>(slot).value_name}.size;
+        return SingleHandle<T>{
+            add_option(names, nb_value_elements, &parse_single<T>, std::move(slot))};
+    }
+    template <typename T>
+    MultipleHandle<T>
+    add_multiple(OptionNames const & names, typename ValueTrait<T>::NameType value_name) {
+        auto slot = make_slot(MultipleSlot<T>{std::move(value_name), {}});
+        std::size_t nb_value_elements =
+            Slice<CowStr>{slot_of<MultipleSlot<T>>(slot).value_name}.size;
+        return MultipleHandle<T>{
+            add_option(names, nb_value_elements, &parse_multiple<T>, std::move(slot))};
+    }
+
+    std::size_t nb_options() const noexcept { return nb_occurrences_.size(); }
+    template <typename Handle> std::size_t nb_occurrences(Handle handle) const noexcept {
+        return nb_occurrences_[handle.index];
+    }
+
+    bool value(FlagHandle handle) const noexcept { return nb_occurrences_[handle.index] > 0; }
+    template <typename T>
+    std::optional<typename ValueTrait<T>::ValueType> & value(SingleHandle<T> handle) noexcept {
+        return slot_of<SingleSlot<T>>(slots_[handle.index]).value;
+    }
+    template <typename T>
+    std::optional<typename ValueTrait<T>::ValueType> const &
+    value(SingleHandle<T> handle) const noexcept {
+        return slot_of<SingleSlot<T>>(slots_[handle.index]).value;
+    }
+    template <typename T>
+    std::vector<typename ValueTrait<T>::ValueType> const &
+    values(MultipleHandle<T> handle) const noexcept {
+        return slot_of<MultipleSlot<T>>(slots_[handle.index]).values;
+    }
+
+    void parse(CommandLine command_line);
+    bool try_parse(CommandLine command_line, ParseError & error);
 
-    // TODO positionals = Options without name ?
-    // TODO subcommands
+  private:
+    // Value storage, type erased : value name and values of an option.
+    template <typename T> struct SingleSlot {
+        typename ValueTrait<T>::NameType value_name;
+        std::optional<typename ValueTrait<T>::ValueType> value;
+    };
+    template <typename T> struct MultipleSlot {
+        typename ValueTrait<T>::NameType value_name;
+        std::vector<typename ValueTrait<T>::ValueType> values;
+    };
+    struct SlotDeleter {
+        void (*destroy)(void *) noexcept = nullptr;
+        void operator()(void * slot) const noexcept { destroy(slot); }
+    };
+    using Slot = std::unique_ptr<void, SlotDeleter>;
+    template <typename S> static Slot make_slot(S && slot) {
+        return Slot(new S(std::move(slot)), SlotDeleter{[](void * p) noexcept {
+                        delete static_cast<S *>(p);
+                    }});
+    }
+    template <typename S> static S & slot_of(Slot const & slot) noexcept {
+        return *static_cast<S *>(slot.get());
+    }
+
+    // Parse one occurrence. Null for flags.
+    using ParseFunction =
+        bool (*)(void * slot, std::uint32_t nb_occurrences, CommandLine & state, ParseError & e);
+    template <typename T>
+    static bool
+    parse_single(void * slot, std::uint32_t nb_occurrences, CommandLine & state, ParseError & e) {
+        auto & single = *static_cast<SingleSlot<T> *>(slot);
+        if(nb_occurrences > 0) {
+            e.code = ErrorCode::RepeatedOption;
+            return false;
+        }
+        typename ValueTrait<T>::ValueType parsed{};
+        if(!try_parse_value<T>(state, single.value_name, parsed, e)) {
+            return false;
+        }
+        single.value = std::move(parsed);
+        return true;
+    }
+    template <typename T>
+    static bool parse_multiple(void * slot, std::uint32_t, CommandLine & state, ParseError & e) {
+        auto & multiple = *static_cast<MultipleSlot<T> *>(slot);
+        typename ValueTrait<T>::ValueType parsed{};
+        if(!try_parse_value<T>(state, multiple.value_name, parsed, e)) {
+            return false;
+        }
+        multiple.values.push_back(std::move(parsed));
+        return true;
+    }
+
+    std::uint32_t add_option(
+        OptionNames const & names,
+        std::size_t nb_value_elements,
+        ParseFunction parse_function,
+        Slot slot);
+    string_view long_name(std::size_t index) const noexcept;
+    string_view option_name(std::size_t index) const noexcept;
+
+    template <typename Registry>
+    friend bool try_parse_options(Registry &, CommandLine &, ParseError &);
+    template <typename Registry>
+    friend bool try_parse_element(Registry &, string_view, CommandLine &, bool &, ParseError &);
+    std::size_t find_short(char name) const noexcept;
+    std::size_t find_long(string_view name) const noexcept;
+    bool takes_value(std::size_t id) const noexcept { return nb_value_elements_[id] > 0; }
+    bool parse_option(std::size_t id, CommandLine & state, ParseError & error);
+    bool parse_positional(string_view element, bool, CommandLine &, ParseError & error) noexcept {
+        return fail_unexpected_positional(element, error);
+    }
+
+    // Per option arrays, indexed by option index
+    struct LongName {
+        std::uint32_t offset; // In name_storage_
+        std::uint32_t size;
+    };
+    std::vector<char> short_names_; // '\0' if none
+    std::vector<LongName> long_names_;
+    std::vector<std::uint32_t> nb_occurrences_;
+    std::vector<std::uint8_t> nb_value_elements_;
+    std::vector<ParseFunction> parse_functions_;
+    std::vector<Slot> slots_; // Null for flags
+
+    std::string name_storage_; // Long names, concatenated
+    static constexpr std::uint32_t no_option_index = UINT32_MAX;
+    std::array<std::uint32_t, 256> short_name_index_;
+    std::vector<std::uint32_t> long_name_index_; // Options with long name, sorted by name
 };
 
 } // namespace ropts
 
-#endif
\ No newline at end of file
+#ifdef ROPTS_HEADER_ONLY
+#include "ropts.cpp"
+#endif
+
+#endif
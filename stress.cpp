@@ -0,0 +1,250 @@
+// Scaling stress tests : make stress
+// Parse time per token (or per byte) must stay flat when inputs grow : a super-linear cost in
+// lookup, error formatting or storage makes the run fail. Pathological inputs :
+// - many options sharing a long name prefix (the lookup key is the first 8 bytes),
+// - argv of millions of tokens,
+// - very long tokens, as option names, values, positionals and in error messages.
+// Usage : stress.bin [max_token_size]. Tokens near the CowStr limit (UINT32_MAX) need a few times
+// that size in memory, so the default maximum is smaller.
+#include "ropts.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace ropts;
+
+// Best of a few runs, in ns. reset is not timed.
+template <typename Run, typename Reset> static double best_time(Run && run, Reset && reset) {
+    using Clock = std::chrono::steady_clock;
+    constexpr int nb_runs = 3;
+    double best = 0;
+    for(int i = 0; i < nb_runs; ++i) {
+        reset();
+        auto start = Clock::now();
+        run();
+        auto end = Clock::now();
+        auto ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        best = i == 0 ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+static bool all_ok = true;
+
+// Compare the cost per unit of the largest input to the smallest one.
+static void check_scaling(char const * what, double smallest, double largest, double max_ratio) {
+    double ratio = largest / smallest;
+    bool ok = ratio <= max_ratio;
+    std::printf(
+        "  %s : x%.2f from smallest to largest (limit x%.1f)%s\n",
+        what,
+        ratio,
+        max_ratio,
+        ok ? "" : "  <- SUPER-LINEAR");
+    all_ok = all_ok && ok;
+}
+
+static std::string shared_prefix_name(std::size_t i) {
+    return "a-long-prefix-shared-by-all-options-" + std::to_string(i);
+}
+
+struct SharedPrefixApplication {
+    Application app{"stress"};
+    std::vector<std::unique_ptr<OptionMultiple<int>>> options;
+
+    explicit SharedPrefixApplication(std::size_t nb_options) {
+        app.reserve(nb_options);
+        for(std::size_t i = 0; i < nb_options; ++i) {
+            options.emplace_back(new OptionMultiple<int>{CowStr(shared_prefix_name(i))});
+            options.back()->value_name = "N";
+            app.add(*options.back());
+        }
+    }
+    void reset() {
+        for(auto & option : options) {
+            decltype(option->values)().swap(option->values);
+        }
+    }
+};
+
+// '--name N' pairs spread over all options.
+struct Tokens {
+    std::vector<std::string> storage;
+    std::vector<char const *> argv{"stress"};
+
+    Tokens(std::size_t nb_options, std::size_t nb_tokens) {
+        storage.reserve(nb_tokens);
+        for(std::size_t i = 0; storage.size() + 2 <= nb_tokens; ++i) {
+            storage.emplace_back("--" + shared_prefix_name((i * 7919) % nb_options));
+            storage.emplace_back(std::to_string(i));
+        }
+        for(std::string const & token : storage) {
+            argv.push_back(token.c_str());
+        }
+    }
+    CommandLine command_line() const { return {int(argv.size()), argv.data()}; }
+};
+
+// Per token cost of a successful parse, when the number of tokens and options grows.
+static void stress_many_tokens_and_options() {
+    std::printf("Shared prefix options, ns/token :\n");
+    std::vector<std::size_t> const nb_options_list = {100, 1000, 10000};
+    std::vector<std::size_t> const nb_tokens_list = {10000, 100000, 1000000};
+    std::vector<std::vector<double>> ns_per_token;
+    for(std::size_t nb_options : nb_options_list) {
+        SharedPrefixApplication app{nb_options};
+        ns_per_token.emplace_back();
+        std::printf("  options=%-6zu", nb_options);
+        for(std::size_t nb_tokens : nb_tokens_list) {
+            Tokens tokens{nb_options, nb_tokens};
+            double ns = best_time(
+                [&] { app.app.parse(tokens.command_line()); }, [&] { app.reset(); });
+            ns_per_token.back().push_back(ns / double(nb_tokens));
+            std::printf("  tokens=%-8zu %8.2f", nb_tokens, ns_per_token.back().back());
+        }
+        std::printf("\n");
+    }
+    for(std::size_t i = 0; i < nb_options_list.size(); ++i) {
+        check_scaling(
+            ("tokens, options=" + std::to_string(nb_options_list[i])).c_str(),
+            ns_per_token[i].front(),
+            ns_per_token[i].back(),
+            3.);
+    }
+    // Lookup is logarithmic : 100x more options is ~2x more comparisons, plus cache misses.
+    check_scaling(
+        "options, 1M tokens", ns_per_token.front().back(), ns_per_token.back().back(), 8.);
+}
+
+// Error at the last of many tokens : unknown option, as found by the const parse too.
+static void stress_late_error() {
+    std::printf("Error after many tokens, ns/token :\n");
+    SharedPrefixApplication app{1000};
+    std::vector<double> ns_per_token;
+    std::vector<std::size_t> const nb_tokens_list = {10000, 1000000};
+    for(std::size_t nb_tokens : nb_tokens_list) {
+        Tokens tokens{1000, nb_tokens};
+        std::string unknown = "--" + shared_prefix_name(1000);
+        tokens.argv.push_back(unknown.c_str());
+        ParseError error;
+        double ns = best_time(
+            [&] {
+                app.app.try_parse(tokens.command_line(), error);
+                (void)error.message();
+            },
+            [&] { app.reset(); });
+        bool expected_error = error.code == ErrorCode::UnknownOption &&
+                              error.element_index == tokens.argv.size() - 1;
+        if(!expected_error) {
+            std::printf("  unexpected error: %s\n", error.message().c_str());
+            all_ok = false;
+        }
+        ns_per_token.push_back(ns / double(nb_tokens + 1));
+        std::printf("  tokens=%-8zu %8.2f\n", nb_tokens + 1, ns_per_token.back());
+    }
+    check_scaling("tokens", ns_per_token.front(), ns_per_token.back(), 3.);
+}
+
+// Long tokens : values (views), positionals, long option names and error messages (copies).
+// Per byte costs grow with the memory hierarchy level the token lives in : they are compared in
+// units of a plain copy of the token (allocation and memcpy), measured at the same size.
+static void stress_long_tokens(std::size_t max_token_size) {
+    std::printf("Long tokens, ns/byte (cost in token copies) :\n");
+    std::vector<std::size_t> sizes;
+    for(std::size_t size = std::size_t(1) << 20; size <= max_token_size; size *= 8) {
+        sizes.push_back(size);
+    }
+    if(sizes.size() < 2) {
+        std::printf("  max_token_size too small\n");
+        all_ok = false;
+        return;
+    }
+    std::vector<double> value_copies, name_copies, error_copies;
+    for(std::size_t size : sizes) {
+        // '--value=<long>' and a long positional : views only
+        std::string value = "--value=" + std::string(size, 'v');
+        std::string positional(size, 'p');
+        // '--<long name> 1' : the name is a heap CowStr, compared in full at lookup
+        std::string long_name(size, 'n');
+        std::string name_token = "--" + long_name;
+        std::string unknown = "--" + std::string(size - 1, 'n') + "x";
+
+        OptionMultiple<string_view> value_option{"value"};
+        OptionMultiple<int> long_name_option{CowStr(long_name)};
+        long_name_option.value_name = "N";
+        Positionals positionals;
+        Application app{"stress"};
+        app.add({&value_option, &long_name_option});
+        app.set_positionals(positionals);
+
+        std::size_t copy_size = 0;
+        double copy_ns = best_time(
+            [&] {
+                std::string copy(unknown);
+                copy_size = copy.size();
+            },
+            [] {});
+
+        char const * value_argv[] = {"stress", value.c_str(), positional.c_str()};
+        double value_ns = best_time(
+            [&] { app.parse({3, value_argv}); }, [&] { value_option.values.clear(); });
+
+        char const * name_argv[] = {"stress", name_token.c_str(), "1"};
+        double name_ns = best_time(
+            [&] { app.parse({3, name_argv}); }, [&] { long_name_option.values.clear(); });
+
+        // The message contains the element
+        char const * unknown_argv[] = {"stress", unknown.c_str()};
+        std::size_t message_size = 0;
+        double error_ns = best_time(
+            [&] {
+                ParseError error;
+                app.try_parse({2, unknown_argv}, error);
+                message_size = error.message().size();
+            },
+            [] {});
+        if(message_size <= size || copy_size != unknown.size()) {
+            std::printf("  unexpected error message size %zu\n", message_size);
+            all_ok = false;
+        }
+
+        value_copies.push_back(value_ns / (2 * copy_ns)); // Two tokens
+        name_copies.push_back(name_ns / copy_ns);
+        error_copies.push_back(error_ns / copy_ns);
+        auto per_byte = [size](double ns) { return ns / double(size); };
+        std::printf(
+            "  size=%-10zu value+positional %7.4f (%5.2f)  long name %7.4f (%5.2f)  "
+            "error message %7.4f (%5.2f)\n",
+            size,
+            per_byte(value_ns / 2),
+            value_copies.back(),
+            per_byte(name_ns),
+            name_copies.back(),
+            per_byte(error_ns),
+            error_copies.back());
+    }
+    check_scaling("value+positional", value_copies.front(), value_copies.back(), 3.);
+    check_scaling("long name", name_copies.front(), name_copies.back(), 3.);
+    check_scaling("error message", error_copies.front(), error_copies.back(), 3.);
+}
+
+int main(int argc, char * argv[]) {
+    std::size_t max_token_size = std::size_t(64) << 20;
+    if(argc > 1) {
+        max_token_size = std::strtoull(argv[1], nullptr, 0);
+        if(max_token_size > UINT32_MAX) {
+            std::fprintf(stderr, "max_token_size must be at most UINT32_MAX\n");
+            return 2;
+        }
+    }
+    stress_many_tokens_and_options();
+    stress_late_error();
+    stress_long_tokens(max_token_size);
+    std::printf(all_ok ? "OK\n" : "FAILED : super-linear scaling\n");
+    return all_ok ? 0 : 1;
+}
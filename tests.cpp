@@ -1,10 +1,21 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_POSIX_SIGNALS // SIGSTKSZ is not a constant in recent glibc
 #include "external/doctest.h"
 
 #include "ropts.h"
 
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <cstddef>
+#include <memory_resource>
+#include <limits>
 #include <string>
 
+#ifdef __unix__
+#include <unistd.h> // pipe
+#endif
+
 using namespace ropts;
 
 TEST_CASE("cow_str") {
@@ -22,6 +33,31 @@ TEST_CASE("cow_str") {
     s = CowStr::borrowed(lvalue_string);
     CHECK(s.view() == "lvalue std::string");
     CHECK(s.type() == CowStr::Type::Borrowed);
+
+    // Short owned strings are inline
+    std::string short_string{"fourteen chars"};
+    s = CowStr(short_string);
+    CHECK(s.view() == "fourteen chars");
+    CHECK(s.type() == CowStr::Type::Owned);
+    auto const * object = reinterpret_cast<char const *>(&s);
+    CHECK((s.data() >= object && s.data() < object + sizeof(CowStr)));
+    CowStr moved = std::move(s);
+    CHECK(moved.view() == "fourteen chars");
+    CHECK(s.empty());
+    moved = CowStr(string_view("long enough for heap"));
+    CHECK(moved.view() == "long enough for heap");
+    CHECK(moved.type() == CowStr::Type::Owned);
+
+    StringInterner interner;
+    std::string generated{"help text generated at runtime"};
+    CowStr a = interner.intern(generated);
+    CowStr b = interner.intern(std::string(generated));
+    CHECK(a.view() == generated);
+    CHECK(a.data() == b.data());
+    CHECK(a.type() == CowStr::Type::Borrowed);
+    CHECK(interner.intern("other").view() == "other");
+    CHECK(interner.intern("").empty());
+    CHECK(interner.size() == 2);
 }
 
 TEST_CASE("text_conversion") {
@@ -51,6 +87,22 @@ TEST_CASE("text_conversion") {
         buf.clear();
         CHECK(write_value(buf, static_cast<long double>(42.1)) == 4);
         CHECK(buf == "42.1");
+        buf.clear();
+        CHECK(write_value(buf, int(-2147483647 - 1)) == 11);
+        CHECK(buf == "-2147483648");
+        buf.clear();
+        CHECK(write_value(buf, long(LONG_MIN)) == 20);
+        CHECK(buf == "-9223372036854775808");
+        buf.clear();
+        // Shortest representation which parses back to the same value
+        CHECK(write_value(buf, double(123456789.)) == 9);
+        CHECK(buf == "123456789");
+        buf.clear();
+        write_value(buf, double(0.1) + double(0.2));
+        CHECK(ValueTrait<double>::parse(buf, "a") == double(0.1) + double(0.2));
+        buf.clear();
+        write_value(buf, -std::numeric_limits<double>::min());
+        CHECK(ValueTrait<double>::parse(buf, "a") == -std::numeric_limits<double>::min());
     }
     {
         // Str to num, from string view
@@ -58,24 +110,24 @@ TEST_CASE("text_conversion") {
         CHECK(ValueTrait<int>::parse("-4000", "a") == -4000);
         CHECK(ValueTrait<int>::parse("007", "a") == 7);
         CHECK(ValueTrait<int>::parse("0xF", "a") == 15);
-        CHECK_THROWS_AS_MESSAGE(
+        CHECK_THROWS_WITH_AS(
             ValueTrait<int>::parse("45.67", "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): '45.67'");
-        CHECK_THROWS_AS_MESSAGE(
+            "value 'a' is not a valid integer (int): '45.67'",
+            Exception);
+        CHECK_THROWS_WITH_AS(
             ValueTrait<int>::parse("azerty", "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): 'azerty'");
-        CHECK_THROWS_AS_MESSAGE(
+            "value 'a' is not a valid integer (int): 'azerty'",
+            Exception);
+        CHECK_THROWS_WITH_AS(
             ValueTrait<int>::parse("42 ", "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): '42 '");
+            "value 'a' is not a valid integer (int): '42 '",
+            Exception);
 
         CHECK(ValueTrait<long>::parse("42", "a") == 42);
-        CHECK_THROWS_AS_MESSAGE(
+        CHECK_THROWS_WITH_AS(
             ValueTrait<long>::parse("45.67", "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): '45.67'");
+            "value 'a' is not a valid integer (long): '45.67'",
+            Exception);
 
         CHECK(ValueTrait<float>::parse("42", "a") == float(42));
 
@@ -84,22 +136,1402 @@ TEST_CASE("text_conversion") {
 
         CHECK(ValueTrait<long double>::parse("42", "a") == static_cast<long double>(42));
     }
+    {
+        // Str to num, prefixes and limits (same behavior as strto<T>)
+        CHECK(ValueTrait<int>::parse("+5", "a") == 5);
+        CHECK(ValueTrait<int>::parse("-0x10", "a") == -16);
+        CHECK(ValueTrait<int>::parse("0X1f", "a") == 31);
+        CHECK(ValueTrait<int>::parse("-010", "a") == -8);
+        CHECK(ValueTrait<int>::parse("0", "a") == 0);
+        CHECK(ValueTrait<int>::parse("-2147483648", "a") == -2147483647 - 1);
+        CHECK(ValueTrait<long>::parse("-9223372036854775808", "a") == LONG_MIN);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("2147483648", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<long>::parse("9223372036854775808", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("-", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("--1", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("+-1", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("0x", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("0x-1", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<int>::parse("08", "a"), Exception);
+        // Unlike strto<T>, leading whitespace is rejected
+        CHECK_THROWS_WITH_AS(
+            ValueTrait<int>::parse(" 42", "a"),
+            "value 'a' is not a valid integer (int): ' 42'",
+            Exception);
+        CHECK_THROWS_AS(ValueTrait<long>::parse("\t42", "a"), Exception);
+        CHECK_THROWS_WITH_AS(
+            ValueTrait<double>::parse(" 1.5", "a"),
+            "value 'a' is not a valid double: ' 1.5'",
+            Exception);
+
+        CHECK(ValueTrait<double>::parse("+1.5", "a") == 1.5);
+        CHECK(ValueTrait<double>::parse("-2.5e-3", "a") == -2.5e-3);
+        CHECK(ValueTrait<double>::parse("0x1p3", "a") == 8.);
+        CHECK(ValueTrait<double>::parse("-0x1.8p1", "a") == -3.);
+        CHECK(ValueTrait<double>::parse("inf", "a") == std::numeric_limits<double>::infinity());
+        CHECK(ValueTrait<float>::parse("0.25", "a") == 0.25f);
+        CHECK(ValueTrait<long double>::parse("-0.5", "a") == -0.5L);
+        CHECK_THROWS_AS(ValueTrait<double>::parse("", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<double>::parse("--1", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<double>::parse("0x-1p3", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<double>::parse("1e400", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<float>::parse("1e40", "a"), Exception);
+        CHECK_THROWS_AS(ValueTrait<double>::parse("1.5 ", "a"), Exception);
+    }
     {
         // Str to num, extraction from Commandline
         constexpr int argc = 4;
         char const * argv[argc] = {"ignored", "42", "45.67", "azerty"};
         CommandLine state{argc, argv};
         CHECK(ValueTrait<int>::parse(state, "a") == 42);
-        CHECK_THROWS_AS_MESSAGE(
+        CHECK_THROWS_WITH_AS(
             ValueTrait<int>::parse(state, "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): '45.67'");
-        CHECK_THROWS_AS_MESSAGE(
+            "value 'a' is not a valid integer (int): '45.67'",
+            Exception);
+        CHECK_THROWS_WITH_AS(
             ValueTrait<int>::parse(state, "a"),
-            Exception,
-            "value 'a' is not a valid integer (int): 'azerty'");
-        CHECK_THROWS_AS_MESSAGE(ValueTrait<int>::parse(state, "a"), Exception, "missing value 'a'");
+            "value 'a' is not a valid integer (int): 'azerty'",
+            Exception);
+        CHECK_THROWS_WITH_AS(ValueTrait<int>::parse(state, "a"), "missing value 'a'", Exception);
+    }
+}
+
+TEST_CASE("option_lookup") {
+    Application app{"test"};
+    Flag verbose{'v', "verbose"};
+    app.add(verbose);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionMultiple<int> inputs{"input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+
+    {
+        char const * argv[] = {"", "--input", "1", "-v", "--factor", "3", "--input", "2"};
+        app.parse({8, argv});
+    }
+    CHECK(verbose.value());
+    CHECK(factor.value == 3);
+    CHECK(inputs.values == std::vector<int>{1, 2});
+
+    // Index must be rebuilt after add()
+    Flag late{'l'};
+    app.add(late);
+    {
+        char const * argv[] = {"", "-l", "--input", "3"};
+        app.parse({4, argv});
+    }
+    CHECK(late.value());
+    CHECK(inputs.values == std::vector<int>{1, 2, 3});
+
+    // Occurrence counts do not wrap around at 2^16
+    {
+        std::vector<char const *> argv(70000, "-v"); // Program name, then 69999 occurrences
+        app.parse({int(argv.size()), argv.data()});
+    }
+    CHECK(verbose.value());
+    CHECK(verbose.nb_occurrences() == 1 + 69999);
+
+    // Bulk registration, in order
+    Flag a{'a'}, b{'b', "bee"};
+    app.add({&a, &b});
+    {
+        char const * argv[] = {"", "--bee", "-a"};
+        app.parse({3, argv});
+    }
+    CHECK(a.value());
+    CHECK(b.value());
+    CHECK(app.usage().find("\n  -a ") < app.usage().find("\n  -b,--bee "));
+
+    {
+        char const * argv[] = {"", "--inpu"};
+        CHECK_THROWS_WITH_AS(app.parse({2, argv}), "unknown option name: '--inpu'", Exception);
+    }
+    {
+        char const * argv[] = {"", "-x"};
+        CHECK_THROWS_WITH_AS(app.parse({2, argv}), "unknown option name: '-x'", Exception);
+    }
+}
+
+TEST_CASE("long_name_lookup_shared_prefixes") {
+    // Names around the 8 byte prefix used by the index
+    Application app{"test"};
+    Flag a{"compress"}, b{"compress-"}, c{"compression"}, d{"compressionlevel"}, e{"com"};
+    for(Flag * flag : {&a, &b, &c, &d, &e}) {
+        app.add(*flag);
+    }
+    char const * argv[] = {"", "--compression", "--com", "--compress"};
+    app.parse({4, argv});
+    CHECK(a.value());
+    CHECK_FALSE(b.value());
+    CHECK(c.value());
+    CHECK_FALSE(d.value());
+    CHECK(e.value());
+    for(char const * name : {"--compressio", "--compressionlevel2", "--co", "--compresz"}) {
+        char const * unknown[] = {"", name};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({2, unknown}, error));
+        CHECK(error.code == ErrorCode::UnknownOption);
+    }
+}
+
+TEST_CASE("packed_and_attached_values") {
+    Application app{"test"};
+    Flag all{'a', "all"};
+    app.add(all);
+    Flag brief{'b'};
+    app.add(brief);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionMultiple<string_view> inputs{'i', "input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+
+    char const * argv[] = {"", "-ab", "--factor=3", "-iX", "-bi", "Y", "--input=", "-ai-Z"};
+    app.parse({8, argv});
+    CHECK(all.nb_occurrences() == 2);
+    CHECK(brief.nb_occurrences() == 2);
+    CHECK(factor.value == 3);
+    CHECK(inputs.values == std::vector<string_view>{"X", "Y", "", "-Z"});
+    // Values are views into argv
+    CHECK(inputs.values[0].data() == argv[3] + 2);
+    CHECK(inputs.values[3].data() == argv[7] + 3);
+
+    {
+        char const * bad[] = {"", "-abx"};
+        CHECK_THROWS_WITH_AS(app.parse({2, bad}), "unknown option name: '-x' in '-abx'", Exception);
+    }
+    {
+        char const * bad[] = {"", "--all=yes"};
+        CHECK_THROWS_WITH_AS(
+            app.parse({2, bad}), "option does not take a value: '--all=yes'", Exception);
+    }
+    {
+        char const * bad[] = {"", "--other=1"};
+        CHECK_THROWS_WITH_AS(app.parse({2, bad}), "unknown option name: '--other'", Exception);
+    }
+}
+
+TEST_CASE("list_values") {
+    Application app{"test"};
+    OptionMultiple<List<int>> ids{'i', "ids"};
+    ids.value_name = "ID";
+    app.add(ids);
+    OptionSingle<List<string_view, ':'>> path{"path"};
+    path.value_name = "DIRS";
+    app.add(path);
+
+    char const * argv[] = {"", "--ids", "1,2,-3", "-i4", "--path=/usr:/bin", "--ids="};
+    app.parse({6, argv});
+    REQUIRE(ids.values.size() == 3);
+    CHECK(ids.values[0] == std::vector<int>{1, 2, -3});
+    CHECK(ids.values[1] == std::vector<int>{4});
+    CHECK(ids.values[2].empty());
+    REQUIRE(path.value);
+    CHECK(*path.value == std::vector<string_view>{"/usr", "/bin"});
+    CHECK(path.value->back().data() == argv[4] + 12); // View into argv
+
+    std::string buffer;
+    CHECK(ValueTrait<List<int>>::write(buffer, {1, 2, 3}) == 5);
+    CHECK(buffer == "1,2,3");
+    CHECK(
+        ValueTrait<List<string_view>>::parse("a,,b", "v") ==
+        std::vector<string_view>{"a", "", "b"});
+
+    {
+        char const * bad[] = {"", "--ids", "1,x,3"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({3, bad}, error));
+        CHECK(error.code == ErrorCode::InvalidValue);
+        CHECK(error.text == "x");
+        CHECK(error.option == &ids);
+    }
+    {
+        char const * bad[] = {"", "--ids"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({2, bad}, error));
+        CHECK(error.code == ErrorCode::MissingValue);
+    }
+}
+
+enum class Mode { Fast, Safe, Debug };
+namespace ropts {
+template <> struct ChoiceNames<Mode> {
+    static constexpr auto table = make_name_table("fast", "safe", "debug");
+};
+} // namespace ropts
+
+TEST_CASE("choices") {
+    using Trait = ValueTrait<Choice<Mode>>;
+    static_assert(Trait::choices() == "{fast,safe,debug}", "built at compile time");
+
+    Application app{"test"};
+    OptionSingle<Choice<Mode>> mode{'m', "mode"};
+    mode.help_text = "Speed";
+    app.add(mode);
+    OptionMultiple<List<Choice<Mode>>> modes{"modes"};
+    modes.value_name = "MODES";
+    app.add(modes);
+
+    char const * argv[] = {"", "--mode", "safe", "--modes=debug,fast"};
+    app.parse({4, argv});
+    CHECK(mode.value == Mode::Safe);
+    REQUIRE(modes.values.size() == 1);
+    CHECK(modes.values[0] == std::vector<Mode>{Mode::Debug, Mode::Fast});
+
+    std::string buffer;
+    CHECK(Trait::write(buffer, Mode::Debug) == 5);
+    CHECK(buffer == "debug");
+    CHECK(Trait::parse("fast", "M") == Mode::Fast);
+
+    // Listed in usage as the default value name
+    CHECK(
+        app.usage() == "test [options]\n"
+                       "\n"
+                       "Options:\n"
+                       "  -m,--mode {fast,safe,debug}   Speed\n"
+                       "  --modes MODES                 \n");
+
+    {
+        char const * bad[] = {"", "--modes", "safe,slow"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({3, bad}, error));
+        CHECK(error.code == ErrorCode::InvalidValue);
+        CHECK(error.text == "slow");
+        CHECK(
+            error.message() ==
+            "option 'modes': value 'MODES' is not a valid choice {fast,safe,debug}: 'slow'");
     }
+    {
+        ParseError error;
+        Mode value = Mode::Fast;
+        CHECK_FALSE(Trait::try_parse("", mode.value_name, value, error));
+        CHECK(error.message() == "value '{fast,safe,debug}' is not a valid choice: ''");
+        // Same message if the name is a copy of the choices
+        std::string const copy{Trait::choices()};
+        CHECK_FALSE(Trait::try_parse("", copy, value, error));
+        CHECK(error.message() == "value '{fast,safe,debug}' is not a valid choice: ''");
+    }
+}
+
+TEST_CASE("lazy_options") {
+    Application app{"test"};
+    OptionSingleLazy<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionSingleLazy<double> ratio{"ratio"};
+    ratio.value_name = "R";
+    ratio.default_value = 0.5;
+    app.add(ratio);
+    OptionMultipleLazy<int> inputs{'i', "input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+    OptionMultipleLazy<std::tuple<int, string_view>> pairs{"pair"};
+    pairs.value_name = {"A", "B"};
+    app.add(pairs);
+
+    // Bad values are only reported on access
+    char const * argv[] = {"", "-f", "x", "--input=1", "--pair", "2", "two", "-i", "y", "-i3"};
+    app.parse({10, argv});
+    CHECK(factor.elements().size == 1);
+    CHECK(factor.elements()[0].data() == argv[2]);
+    CHECK_THROWS_WITH_AS(
+        factor.value(),
+        "option 'factor': value 'N' is not a valid integer (int): 'x'",
+        Exception);
+    CHECK(ratio.value() == 0.5);
+    CHECK(inputs.elements().size == 3);
+    CHECK_THROWS_AS(inputs.values(), Exception);
+    CHECK(pairs.values().size() == 1);
+    CHECK(pairs.values()[0] == std::make_tuple(2, string_view("two")));
+
+    OptionMultipleLazy<int> numbers{"n"};
+    numbers.value_name = "N";
+    Application app2{"test2"};
+    app2.add(numbers);
+    char const * argv2[] = {"", "--n", "1", "--n", "2"};
+    app2.parse({5, argv2});
+    CHECK(numbers.values() == std::vector<int>{1, 2});
+    char const * argv3[] = {"", "--n", "3"};
+    app2.parse({3, argv3});
+    CHECK(numbers.values() == std::vector<int>{1, 2, 3});
+
+    // Missing value is a structural error, reported by parse
+    char const * argv4[] = {"", "--n"};
+    CHECK_THROWS_WITH_AS(app2.parse({2, argv4}), "option 'n': missing value 'N'", Exception);
+    CHECK(numbers.elements().size == 3);
+}
+
+TEST_CASE("try_parse") {
+    Application app{"test"};
+    Flag all{'a', "all"};
+    app.add(all);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+
+    auto try_parse = [&app](std::vector<char const *> argv, ParseError & error) {
+        argv.insert(argv.begin(), "");
+        return app.try_parse({int(argv.size()), argv.data()}, error);
+    };
+    {
+        ParseError error;
+        CHECK(try_parse({"-a", "--all"}, error));
+        CHECK(!error);
+    }
+    {
+        ParseError error;
+        CHECK(!try_parse({"-a", "--other=2"}, error));
+        CHECK(error.code == ErrorCode::UnknownOption);
+        CHECK(error.element_index == 2);
+        CHECK(error.option == nullptr);
+        CHECK(error.name == "other");
+        CHECK(error.message() == "unknown option name: '--other'");
+    }
+    {
+        ParseError error;
+        CHECK(!try_parse({"-ax"}, error));
+        CHECK(error.code == ErrorCode::UnknownOption);
+        CHECK(error.message() == "unknown option name: '-x' in '-ax'");
+    }
+    {
+        ParseError error;
+        CHECK(!try_parse({"--all=1"}, error));
+        CHECK(error.code == ErrorCode::UnexpectedValue);
+        CHECK(error.message() == "option does not take a value: '--all=1'");
+    }
+    {
+        ParseError error;
+        CHECK(!try_parse({"-a", "--factor"}, error));
+        CHECK(error.code == ErrorCode::MissingValue);
+        CHECK(error.option == &factor);
+        CHECK(error.value_name == "N");
+        CHECK(error.message() == "option 'factor': missing value 'N'");
+    }
+    {
+        ParseError error;
+        CHECK(!try_parse({"-a", "-f", "0x"}, error));
+        CHECK(error.code == ErrorCode::InvalidValue);
+        CHECK(error.element_index == 3);
+        CHECK(error.option == &factor);
+        CHECK(error.text == "0x");
+        CHECK(error.type_name == "integer (int)");
+    }
+    {
+        ParseError error;
+        CHECK(try_parse({"-f3"}, error));
+        CHECK(!try_parse({"--factor=4"}, error));
+        CHECK(error.code == ErrorCode::RepeatedOption);
+        CHECK(error.message() == "option 'factor' cannot be used more than once");
+    }
+    {
+        // The error is reset by each parse : reusable after a failure
+        ParseError error;
+        CHECK(!try_parse({"-x"}, error));
+        CHECK(try_parse({"-a"}, error));
+        CHECK(!error);
+        ParseResults results = app.make_results();
+        char const * bad_argv[] = {"", "-x"};
+        char const * argv[] = {"", "-a"};
+        CHECK(!app.try_parse({2, bad_argv}, results, error));
+        CHECK(app.try_parse({2, argv}, results, error));
+        CHECK(!error);
+    }
+    {
+        ResponseFiles response_files;
+        char const * argv[] = {"", "-a", "@ropts_test_missing_file.txt"};
+        ParseError error;
+        CHECK(!app.try_parse({3, argv, response_files}, error));
+        CHECK(error.code == ErrorCode::ResponseFile);
+        CHECK(error.element_index == 2);
+        CHECK(error.message() == "cannot read response file 'ropts_test_missing_file.txt'");
+    }
+    {
+        // Exceptions from user code are reported as ErrorCode::Other
+        Application callbacks{"callbacks"};
+        OptionMultiple<int> values{'v'};
+        values.value_name = "V";
+        values.on_value = [](int) { throw std::runtime_error("rejected"); };
+        callbacks.add(values);
+        char const * argv[] = {"", "-v", "1"};
+        ParseError error;
+        CHECK(!callbacks.try_parse({3, argv}, error));
+        CHECK(error.code == ErrorCode::Other);
+        CHECK(error.message() == "option 'v': rejected");
+    }
+    {
+        int value = 0;
+        ParseError error;
+        CHECK(ValueTrait<int>::try_parse("0x10", "a", value, error));
+        CHECK(value == 16);
+        double d = 0;
+        CHECK(!ValueTrait<double>::try_parse("1.5.2", "a", d, error));
+        CHECK(error.message() == "value 'a' is not a valid double: '1.5.2'");
+    }
+}
+
+TEST_CASE("prescan") {
+    Application app{"test"};
+    OptionMultiple<int> inputs{'i', "input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+    Flag verbose{'v'};
+    app.add(verbose);
+    app.enable_prescan();
+    Positionals positionals;
+    app.set_positionals(positionals);
+
+    char const * argv[] = {
+        "", "--input", "1", "-v", "-i", "2", "--input=3", "-vi4", "--", "-i"};
+    app.parse({10, argv});
+    CHECK(inputs.values == std::vector<int>{1, 2, 3, 4});
+    CHECK(inputs.values.capacity() == 4);
+
+    OptionMultiple<int> hinted{'h'};
+    hinted.reserve_occurrences(10);
+    CHECK(hinted.values.capacity() >= 10);
+}
+
+// Memory resource which fails on allocation after the initial buffer is used.
+struct TestArena {
+    std::array<std::byte, 4096> buffer;
+    std::pmr::monotonic_buffer_resource resource{
+        buffer.data(), buffer.size(), std::pmr::null_memory_resource()};
+};
+
+// Counts allocations, forwarded to the default resource.
+struct CountingResource final : std::pmr::memory_resource {
+    std::size_t nb_allocations = 0;
+
+    void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+        nb_allocations += 1;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void * p, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override {
+        return this == &other;
+    }
+};
+
+TEST_CASE("memory_resource") {
+    TestArena arena;
+    {
+        std::string runtime_name = "runtime-name";
+        CowStr s = CowStr::copied(runtime_name, arena.resource);
+        runtime_name.clear();
+        CHECK(s.view() == "runtime-name");
+        CHECK(s.type() == CowStr::Type::Borrowed);
+        CHECK(CowStr::copied("", arena.resource).empty());
+    }
+    {
+        Application app{"test", &arena.resource};
+        CHECK(app.resource() == &arena.resource);
+        pmr::OptionMultiple<int> inputs{std::allocator_arg, &arena.resource, 'i', "input"};
+        inputs.value_name = "I";
+        app.add(inputs);
+        app.enable_prescan();
+        char const * argv[] = {"", "-i", "1", "--input", "2"};
+        app.parse({5, argv});
+        CHECK(inputs.values.size() == 2);
+        CHECK(inputs.values[1] == 2);
+        CHECK(inputs.values.get_allocator().resource() == &arena.resource);
+    }
+    {
+        // Const parse results use the allocator of the option values
+        CountingResource counting;
+        Application app{"test"};
+        pmr::OptionMultiple<int> inputs{std::allocator_arg, &counting, 'i', "input"};
+        inputs.value_name = "I";
+        app.add(inputs);
+        ParseResults results = app.make_results();
+        char const * argv[] = {"", "-i", "1", "--input", "2"};
+        app.parse({5, argv}, results);
+        auto const & values = results.get(inputs);
+        CHECK(values == std::pmr::vector<int>{1, 2});
+        CHECK(values.get_allocator().resource() == &counting);
+        CHECK(counting.nb_allocations > 0);
+        CHECK(inputs.values.empty());
+    }
+    {
+        // Results storage, positionals, lazy elements and usage text use the given resources
+        CountingResource counting;
+        Application app{"test", &counting};
+        OptionMultipleLazy<int> inputs{std::allocator_arg, &counting, 'i', "input"};
+        inputs.value_name = "I";
+        Flag verbose{'v'};
+        app.add({&inputs, &verbose});
+        Positionals positionals{&counting};
+        app.set_positionals(positionals);
+        char const * argv[] = {"", "a", "-v", "b", "-i", "1", "--input", "2"};
+
+        std::size_t nb_allocations = counting.nb_allocations;
+        app.parse({8, argv});
+        CHECK(counting.nb_allocations > nb_allocations);
+        CHECK(!positionals.is_argv_slice());
+        CHECK(inputs.values() == std::vector<int>{1, 2});
+
+        nb_allocations = counting.nb_allocations;
+        CHECK(!app.usage().empty());
+        CHECK(counting.nb_allocations > nb_allocations);
+
+        nb_allocations = counting.nb_allocations;
+        ParseResults results = app.make_results();
+        CHECK(counting.nb_allocations > nb_allocations);
+        nb_allocations = counting.nb_allocations;
+        app.parse({8, argv}, results);
+        CHECK(counting.nb_allocations > nb_allocations);
+        CHECK(results.get(inputs).get_allocator().resource() == &counting);
+        CHECK(results.positionals().size() == 2);
+        CHECK(results.positionals()[1] == "b");
+    }
+}
+
+#ifdef ROPTS_INSTRUMENTATION
+TEST_CASE("instrumentation") {
+    Application app{"test"};
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionMultiple<int> inputs{"input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+    inputs.values.reserve(2);
+
+    instrumentation() = {};
+    char const * argv[] = {"", "-f", "2", "--input", "2", "--input", "3"};
+    app.parse({7, argv});
+    Instrumentation counters = instrumentation();
+    CHECK(counters.nb_lookups == 3);
+    CHECK(counters.nb_next_calls == 7); // Including the last failing one
+    CHECK(counters.nb_owned_copies == 0);
+    CHECK(counters.nb_allocations == 1); // Index build only
+
+    instrumentation() = {};
+    CowStr inline_copy{string_view("copied")};
+    CHECK(instrumentation().nb_owned_copies == 1);
+    CHECK(instrumentation().nb_allocations == 0);
+    CowStr copied{string_view("copied to the heap")};
+    CHECK(instrumentation().nb_owned_copies == 2);
+    CHECK(instrumentation().nb_allocations == 1);
+    char const * bad_argv[] = {"", "--unknown"};
+    CHECK_THROWS_AS(app.parse({2, bad_argv}), Exception);
+    CHECK(instrumentation().nb_allocations == 2);
+
+    // Bulk registration is a single allocation
+    instrumentation() = {};
+    Application bulk{"bulk"};
+    Flag a{'a'}, b{'b'}, c{'c'}, d{'d'}, e{'e'};
+    bulk.add({&a, &b, &c, &d, &e});
+    CHECK(instrumentation().nb_allocations == 1);
+    bulk.reserve(6);
+    bulk.add(factor);
+    CHECK(instrumentation().nb_allocations == 2);
+}
+#endif
+
+TEST_CASE("static_name_table") {
+    constexpr auto table = make_name_table("alpha", "beta", "", "gamma", "delta", "epsilon");
+    static_assert(table.find("alpha") == 0);
+    static_assert(table.find("gamma") == 3);
+    static_assert(table.find("epsilon") == 5);
+    static_assert(table.find("") == table.not_found);
+    static_assert(table.find("alph") == table.not_found);
+    CHECK(table.find("beta") == 1);
+    CHECK(table.find("delta") == 4);
+    CHECK(table.find("zeta") == table.not_found);
+
+    constexpr auto empty_table = make_name_table();
+    static_assert(empty_table.find("a") == empty_table.not_found);
+    // Duplicates do not compile in a constant expression, and throw at runtime
+    CHECK_THROWS_WITH_AS(
+        make_name_table("alpha", "beta", "alpha"),
+        "duplicate name in static table: 'alpha'",
+        Exception);
+    CHECK_THROWS_WITH_AS(
+        make_option_table(OptionNames{'f', "factor"}, OptionNames{'f', "file"}),
+        "duplicate name in static table: 'f'",
+        Exception);
+}
+
+TEST_CASE("static_application") {
+    static constexpr auto table = make_option_table(
+        OptionNames{'f', "factor"}, OptionNames{'v', ""}, OptionNames{'\0', "input"});
+    static_assert(table.find_short('f') == 0);
+    static_assert(table.find_short('x') == no_option);
+    static_assert(table.find_long("input") == 2);
+
+    StaticApplication<OptionSingle<int>, Flag, OptionMultiple<int>> app{"test", table};
+    app.get<0>().value_name = "N";
+    app.get<2>().value_name = "I";
+    CHECK(app.get<0>().long_name() == "factor");
+    CHECK(!app.get<1>().has_long_name());
+
+    char const * argv[] = {"", "--input", "1", "-v", "-f", "3", "--input", "2"};
+    app.parse({8, argv});
+    CHECK(app.get<0>().value == 3);
+    CHECK(app.get<1>().value());
+    CHECK(app.get<2>().values == std::vector<int>{1, 2});
+    CHECK(app.get<2>().nb_occurrences() == 2);
+
+    char const * packed_argv[] = {"", "-vv", "--input=3"};
+    app.parse({3, packed_argv});
+    CHECK(app.get<1>().nb_occurrences() == 3);
+    CHECK(app.get<2>().values == std::vector<int>{1, 2, 3});
+
+    char const * bad_argv[] = {"", "--verbose"};
+    CHECK_THROWS_WITH_AS(app.parse({2, bad_argv}), "unknown option name: '--verbose'", Exception);
+}
+
+TEST_CASE("response_files") {
+    char const * path = "ropts_test_response_file.txt";
+    {
+        std::FILE * f = std::fopen(path, "wb");
+        REQUIRE(f != nullptr);
+        char const content[] = "--input\n1\r\n\n-s\0string value\n--input\n2";
+        std::fwrite(content, 1, sizeof(content) - 1, f);
+        std::fclose(f);
+    }
+    ResponseFiles response_files;
+    {
+        Application app{"test"};
+        OptionMultiple<int> inputs{"input"};
+        inputs.value_name = "I";
+        app.add(inputs);
+        OptionSingle<string_view> text{'s'};
+        text.value_name = "S";
+        app.add(text);
+        Flag verbose{'v'};
+        app.add(verbose);
+
+        std::string response_element = std::string("@") + path;
+        char const * argv[] = {"", "-v", response_element.c_str(), "--input", "3"};
+        app.parse({5, argv, response_files});
+        CHECK(verbose.value());
+        CHECK(inputs.values == std::vector<int>{1, 2, 3});
+        CHECK(text.value == "string value");
+
+        // Without storage, '@path' is a normal element
+        char const * argv_no_expansion[] = {"", "-s", response_element.c_str()};
+        OptionSingle<string_view> other{'s'};
+        Application other_app{"other"};
+        other_app.add(other);
+        other_app.parse({3, argv_no_expansion});
+        CHECK(other.value == response_element);
+    }
+    std::remove(path);
+    // Content stays valid (mapped) after the file is removed
+    CHECK(response_files.load(path).substr(0, 7) == "--input");
+
+#ifdef __unix__
+    // Pipes report a zero size, but are not empty
+    int pipe_fds[2];
+    REQUIRE(::pipe(pipe_fds) == 0);
+    char const piped[] = "--input 4";
+    REQUIRE(::write(pipe_fds[1], piped, sizeof(piped) - 1) == sizeof(piped) - 1);
+    ::close(pipe_fds[1]);
+    std::string pipe_path = "/dev/fd/" + std::to_string(pipe_fds[0]);
+    CHECK(response_files.load(pipe_path) == "--input 4");
+    ::close(pipe_fds[0]);
+    // Loaded once : the pipe is not read again
+    CHECK(response_files.load(pipe_path) == "--input 4");
+#endif
+
+    char const * argv[] = {"", "@ropts_test_missing_file"};
+    CommandLine command_line{2, argv, response_files};
+    CHECK_THROWS_WITH_AS(
+        command_line.next(), "cannot read response file 'ropts_test_missing_file'", Exception);
+}
+
+TEST_CASE("fallbacks") {
+    Application app{"test"};
+    OptionSingle<int> jobs{'j', "jobs"};
+    jobs.value_name = "N";
+    jobs.env_name = "ROPTS_TEST_JOBS";
+    app.add(jobs);
+    OptionSingle<std::tuple<int, string_view>> level{"level"};
+    level.value_name = {"L", "NAME"};
+    app.add(level);
+    OptionMultiple<string_view> includes{'I', "include"};
+    includes.value_name = "DIR";
+    app.add(includes);
+    Flag verbose{'v', "verbose"};
+    verbose.env_name = "ROPTS_TEST_VERBOSE";
+    app.add(verbose);
+
+    ConfigValues config;
+    ParseError error;
+    string_view text = "# Comment\n"
+                       "jobs = 2\n"
+                       "  level = 3   high \r\n"
+                       "\n"
+                       "include = /usr\n"
+                       "include=/opt\n"
+                       "verbose\n";
+    REQUIRE(config.try_load_text(app, text, error));
+    CHECK(config.nb_entries() == 5);
+
+    ::setenv("ROPTS_TEST_JOBS", "8", 1);
+    ::setenv("ROPTS_TEST_VERBOSE", "0", 1);
+    {
+        // Command line, then environment, then config
+        char const * argv[] = {"", "-I", "/home"};
+        app.parse({3, argv});
+        app.apply_fallbacks(&config);
+        CHECK(jobs.value == 8);
+        CHECK(level.value == std::make_tuple(3, string_view("high")));
+        CHECK(includes.values == std::vector<string_view>{"/home"});
+        CHECK_FALSE(verbose.value()); // Disabled by the environment
+    }
+    ::unsetenv("ROPTS_TEST_JOBS");
+    ::unsetenv("ROPTS_TEST_VERBOSE");
+
+    // Snapshot : same values, without the text
+    char const * path = "ropts_test_snapshot.bin";
+    REQUIRE(config.try_save_snapshot(path, error));
+    {
+        Application same{"test"};
+        OptionSingle<int> jobs2{'j', "jobs"};
+        jobs2.value_name = "N";
+        same.add(jobs2);
+        OptionSingle<std::tuple<int, string_view>> level2{"level"};
+        level2.value_name = {"L", "NAME"};
+        same.add(level2);
+        OptionMultiple<string_view> includes2{'I', "include"};
+        includes2.value_name = "DIR";
+        same.add(includes2);
+        Flag verbose2{'v', "verbose"};
+        same.add(verbose2);
+        ConfigValues snapshot;
+        REQUIRE(snapshot.try_load_snapshot(same, path, error));
+        CHECK(snapshot.nb_entries() == 5);
+        same.apply_fallbacks(&snapshot);
+        CHECK(jobs2.value == 2);
+        CHECK(std::get<1>(*level2.value) == "high");
+        CHECK(includes2.values == std::vector<string_view>{"/usr", "/opt"});
+        CHECK(verbose2.value());
+    }
+    {
+        // Rejected by another schema
+        Application other{"test"};
+        Flag jobs3{"jobs"};
+        other.add(jobs3);
+        ConfigValues snapshot;
+        CHECK_FALSE(snapshot.try_load_snapshot(other, path, error));
+        CHECK(error.message() == "invalid configuration: 'ropts_test_snapshot.bin'");
+    }
+    std::remove(path);
+
+    for(string_view bad : {"unknown = 1", "jobs = 1 2", "level = 1", "verbose = 1 2"}) {
+        ParseError line_error;
+        CHECK_FALSE(config.try_load_text(app, bad, line_error));
+        CHECK(line_error.code == ErrorCode::Config);
+        CHECK(line_error.text == bad);
+    }
+    CHECK(config.nb_entries() == 5); // Unchanged by failures
+    {
+        Application invalid{"test"};
+        OptionSingle<int> value{"value"};
+        value.value_name = "V";
+        invalid.add(value);
+        ConfigValues values;
+        REQUIRE(values.try_load_text(invalid, "value = x", error));
+        CHECK_FALSE(invalid.try_apply_fallbacks(&values, error));
+        CHECK(error.message() == "option 'value': value 'V' is not a valid integer (int): 'x'");
+    }
+    // Group constraints include fallback values
+    struct GroupedApplication {
+        Application app{"test"};
+        Flag json{"json"}, yaml{"yaml"}, fast{"fast"}, slow{"slow"};
+        OptionGroup format{"format", {&json, &yaml}, OptionGroup::Constraint::MutuallyExclusive};
+        OptionGroup speed{
+            "speed", {&fast, &slow}, OptionGroup::Constraint::RequiredAndMutuallyExclusive};
+        GroupedApplication() {
+            yaml.env_name = "ROPTS_TEST_YAML";
+            app.add({&json, &yaml, &fast, &slow});
+            app.add(format);
+            app.add(speed);
+            app.defer_group_checks();
+        }
+    };
+    {
+        // Required group satisfied by the config
+        GroupedApplication grouped;
+        ConfigValues speed_config;
+        REQUIRE(speed_config.try_load_text(grouped.app, "fast", error));
+        char const * argv[] = {"", "--json"};
+        CHECK(grouped.app.try_parse({2, argv}, error)); // Groups are not checked yet
+        CHECK(grouped.app.try_apply_fallbacks(&speed_config, error));
+        CHECK(grouped.fast.value());
+    }
+    {
+        // Exclusive options from the command line and the environment
+        GroupedApplication grouped;
+        char const * argv[] = {"", "--json", "--slow"};
+        CHECK(grouped.app.try_parse({3, argv}, error));
+        ::setenv("ROPTS_TEST_YAML", "1", 1);
+        CHECK_FALSE(grouped.app.try_apply_fallbacks(nullptr, error));
+        ::unsetenv("ROPTS_TEST_YAML");
+        CHECK(error.message() == "option 'json': cannot be used with option 'yaml'");
+    }
+    {
+        // Still required if no fallback provides a value
+        GroupedApplication grouped;
+        char const * argv[] = {"", "--json"};
+        CHECK(grouped.app.try_parse({2, argv}, error));
+        CHECK_FALSE(grouped.app.try_apply_fallbacks(nullptr, error));
+        CHECK(error.code == ErrorCode::MissingOption);
+    }
+}
+
+TEST_CASE("stream_source") {
+    std::FILE * f = std::tmpfile();
+    REQUIRE(f != nullptr);
+    char const content[] = "--item\0first\0-n\0" "42\0--item\0a longer item than chunks\0--item";
+    std::fwrite(content, 1, sizeof(content) - 1, f);
+    std::rewind(f);
+
+    Application app{"test"};
+    OptionMultiple<string_view> items{"item"};
+    items.value_name = "ITEM";
+    std::vector<std::string> received;
+    items.on_value = [&received](string_view item) { received.emplace_back(item); };
+    app.add(items);
+    OptionSingle<int> n{'n'};
+    n.value_name = "N";
+    app.add(n);
+    app.enable_prescan(); // Ignored for streams
+
+    StreamArgumentSource source{f, '\0', 4}; // Small chunks to test buffer management
+    CHECK_THROWS_WITH_AS(
+        app.parse(CommandLine{source}), "option 'item': missing value 'ITEM'", Exception);
+    std::fclose(f);
+    CHECK(received == std::vector<std::string>{"first", "a longer item than chunks"});
+    CHECK(items.values.empty());
+    CHECK(n.value == 42);
+}
+
+TEST_CASE("usage") {
+    Application app{"test"};
+    OptionSingle<int> factor{'f', "factor"};
+    factor.help_text = "Integer factor";
+    factor.value_name = "N";
+    app.add(factor);
+    Flag verbose{'v'};
+    verbose.help_text = "Verbose";
+    app.add(verbose);
+
+    string_view expected = "test [options]\n"
+                           "\n"
+                           "Options:\n"
+                           "  -f,--factor N   Integer factor\n"
+                           "  -v              Verbose\n";
+    CHECK(app.usage() == expected);
+    CHECK(app.usage().data() == app.usage().data()); // Cached
+
+    // Cache invalidated by add()
+    Flag quiet{"quiet"};
+    app.add(quiet);
+    CHECK(app.usage().substr(expected.size()) == "  --quiet         \n");
+
+    // Or manually
+    quiet.help_text = "Quiet";
+    app.invalidate_usage();
+    CHECK(app.usage().substr(expected.size()) == "  --quiet         Quiet\n");
+}
+
+TEST_CASE("completion") {
+    Application app{"test"};
+    OptionSingle<int> factor{'f', "factor"};
+    app.add(factor);
+    Flag fast{"fast"};
+    app.add(fast);
+    Flag verbose{'v'};
+    app.add(verbose);
+    Flag output{"output"};
+    app.add(output);
+
+    auto names = [&app](string_view partial) {
+        std::vector<std::string> r;
+        for(Application::Completion const & c : app.complete(partial)) {
+            r.push_back(std::string(c.dashes) + std::string(c.name));
+        }
+        return r;
+    };
+    using Strings = std::vector<std::string>;
+    CHECK(names("--f") == Strings{"--factor", "--fast"});
+    CHECK(names("--fa") == Strings{"--factor", "--fast"});
+    CHECK(names("--fas") == Strings{"--fast"});
+    CHECK(names("--x") == Strings{});
+    CHECK(names("--") == Strings{"--factor", "--fast", "--output"});
+    CHECK(names("-") == Strings{"--factor", "--fast", "--output", "-v"});
+    CHECK(names("-f") == Strings{"-f"});
+    CHECK(names("-x") == Strings{});
+    CHECK(names("value") == Strings{});
+    CHECK(app.complete("--fa")[1].option == &fast);
+
+    std::FILE * f = std::tmpfile();
+    REQUIRE(f != nullptr);
+    app.write_completions(f, "--f");
+    std::rewind(f);
+    char buf[64] = {};
+    std::size_t read_size = std::fread(buf, 1, sizeof(buf) - 1, f);
+    std::fclose(f);
+    CHECK(string_view(buf, read_size) == "--factor\n--fast\n");
+}
+
+TEST_CASE("forward") {
+    Application app{"test"};
+    Flag all{'a'};
+    app.add(all);
+    Flag brief{'b'};
+    app.add(brief);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionMultiple<std::tuple<int, int>> pairs{"pair"};
+    pairs.value_name = {"A", "B"};
+    app.add(pairs);
+    Positionals positionals;
+    app.set_positionals(positionals);
+
+    char const * argv[] = {
+        "", "-ab", "--factor", "-1", "--pair=1", "2", "-a", "--pair", "3", "4", "pos", "--", "-a"};
+    int const argc = 13;
+    app.parse({argc, argv});
+
+    std::array<OptionBase const *, 2> selected{{&pairs, &factor}};
+    CHECK(
+        app.forward(argc, argv, Slice<OptionBase const *>{selected}) ==
+        std::vector<char const *>{argv[2], argv[3], argv[4], argv[5], argv[7], argv[8], argv[9]});
+
+    std::array<OptionBase const *, 2> flags{{&all, &brief}};
+    CHECK(
+        app.forward(argc, argv, Slice<OptionBase const *>{flags}) ==
+        std::vector<char const *>{argv[1], argv[6]});
+
+    std::array<OptionBase const *, 1> all_only{{&all}};
+    CHECK_THROWS_WITH_AS(
+        app.forward(argc, argv, Slice<OptionBase const *>{all_only}),
+        "cannot forward a subset of packed options: '-ab'",
+        Exception);
+
+    // Attached values
+    char const * argv2[] = {"", "-bf3", "--pair", "5"};
+    std::array<OptionBase const *, 1> factor_only{{&factor}};
+    CHECK_THROWS_AS(app.forward(4, argv2, Slice<OptionBase const *>{factor_only}), Exception);
+    std::array<OptionBase const *, 3> some{{&factor, &brief, &pairs}};
+    CHECK(
+        app.forward(4, argv2, Slice<OptionBase const *>{some}) ==
+        std::vector<char const *>{argv2[1], argv2[2], argv2[3]});
+}
+
+TEST_CASE("option_groups") {
+    Application app{"test"};
+    Flag json{"json"}, yaml{"yaml"}, text{'t'};
+    Flag fast{"fast"}, slow{"slow"};
+    std::vector<std::unique_ptr<Flag>> others; // Spread group options over several bit words
+    for(int i = 0; i < 100; ++i) {
+        others.emplace_back(new Flag{CowStr("other-" + std::to_string(i))});
+    }
+    app.add(json);
+    for(auto & other : others) {
+        app.add(*other);
+    }
+    app.add(yaml);
+    app.add(text);
+    app.add(fast);
+    app.add(slow);
+
+    OptionGroup format{"format", {&json, &yaml, &text}, OptionGroup::Constraint::MutuallyExclusive};
+    app.add(format);
+    OptionGroup speed{
+        "speed", {&fast, &slow}, OptionGroup::Constraint::RequiredAndMutuallyExclusive};
+    app.add(speed);
+    OptionGroup usage_only{"usage", {&json, others[70].get()}, OptionGroup::Constraint::None};
+    app.add(usage_only);
+
+    auto try_parse = [&app](std::vector<char const *> argv, ParseError & error) {
+        argv.insert(argv.begin(), "");
+        return app.try_parse({int(argv.size()), argv.data()}, error);
+    };
+    {
+        ParseError error;
+        CHECK(try_parse({"--fast", "--yaml", "--other-70", "--json"}, error) == false);
+        CHECK(error.code == ErrorCode::ExclusiveOptions);
+        CHECK(error.message() == "option 'json': cannot be used with option 'yaml'");
+    }
+    {
+        ParseError error;
+        CHECK_FALSE(try_parse({"-t", "--yaml", "--slow"}, error));
+        CHECK(error.message() == "option 'yaml': cannot be used with option 't'");
+    }
+    {
+        ParseError error;
+        CHECK_FALSE(try_parse({"--slow", "--fast"}, error));
+        CHECK(error.message() == "option 'fast': cannot be used with option 'slow'");
+    }
+    {
+        ParseError error;
+        CHECK_FALSE(try_parse({"--json"}, error));
+        CHECK(error.message() == "an option of group 'speed' is required");
+    }
+    {
+        // Repeated occurrences of the same option are not exclusive
+        ParseError error;
+        CHECK(try_parse({"--json", "--json", "--slow", "--other-70"}, error));
+    }
+    {
+        // Const parsing
+        ParseResults results = app.make_results();
+        char const * argv[] = {"", "--fast", "--yaml"};
+        ParseError error;
+        CHECK(app.try_parse({3, argv}, results, error));
+        char const * bad[] = {"", "--yaml"};
+        CHECK_FALSE(app.try_parse({2, bad}, results, error));
+        CHECK(error.code == ErrorCode::MissingOption);
+    }
+}
+
+TEST_CASE("positionals") {
+    Application app{"test"};
+    Flag verbose{'v'};
+    app.add(verbose);
+    {
+        char const * argv[] = {"", "-v", "file"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({3, argv}, error));
+        CHECK(error.message() == "unexpected positional argument: 'file'");
+        CHECK(error.element_index == 2);
+    }
+    Positionals files{"FILE"};
+    app.set_positionals(files);
+    CHECK(app.usage().substr(0, 25) == "test [options] FILE...\n\nO");
+    {
+        // Consecutive argv elements : stored as a slice
+        char const * argv[] = {"", "-v", "a", "b", "c"};
+        app.parse({5, argv});
+        CHECK(files.is_argv_slice());
+        CHECK(files.argv_slice().base == argv + 2);
+        CHECK(files.size() == 3);
+        CHECK(files[2] == "c");
+        // Elements after '--' are not consecutive with previous ones
+        char const * argv2[] = {"", "a", "-v", "--", "-v", "b"};
+        app.parse({6, argv2});
+        CHECK_FALSE(files.is_argv_slice());
+        std::vector<string_view> elements{files.begin(), files.end()};
+        CHECK(elements == std::vector<string_view>{"a", "-v", "b"});
+    }
+    {
+        // All after '--' at once
+        char const * argv[] = {"", "-v", "--", "x", "-y", "--", "z"};
+        app.parse({7, argv});
+        CHECK(files.is_argv_slice());
+        CHECK(files.argv_slice().base == argv + 3);
+        CHECK(files.argv_slice().size == 4);
+        CHECK(files[3] == "z");
+    }
+    {
+        // Not from argv
+        char const * argv[] = {"", "-v", "a"};
+        std::array<string_view, 2> elements{{"b", "c"}};
+        SliceArgumentSource source{Slice<string_view>{elements}};
+        app.parse({3, argv});
+        CHECK(files.size() == 1);
+        app.parse(CommandLine{source});
+        CHECK(files.size() == 2);
+        CHECK(files[0] == "b");
+        CHECK(files[1] == "c");
+    }
+    {
+        ParseResults results = app.make_results();
+        char const * argv[] = {"", "p", "-v", "q"};
+        app.parse({4, argv}, results);
+        CHECK(results.positionals().size() == 2);
+        CHECK(results.positionals()[1] == "q");
+    }
+}
+
+TEST_CASE("subcommands") {
+    Application app{"tool"};
+    Flag verbose{'v', "verbose"};
+    app.add(verbose);
+
+    // Options of subcommands are only created when selected
+    struct BuildOptions {
+        Flag release{'r', "release"};
+        OptionSingle<int> jobs{'j', "jobs"};
+    };
+    std::optional<BuildOptions> build;
+    int nb_build_setups = 0;
+    app.add_subcommand("build", [&](Application & sub) {
+        nb_build_setups += 1;
+        build.emplace();
+        build->jobs.value_name = "N";
+        sub.add(build->release);
+        sub.add(build->jobs);
+    });
+    bool test_setup = false;
+    app.add_subcommand("test", [&](Application &) { test_setup = true; });
+    Positionals positionals; // Set later
+
+    {
+        char const * argv[] = {"", "-v", "build", "-rj4", "--verbose"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({5, argv}, error)); // --verbose is not a build option
+        CHECK(error.code == ErrorCode::UnknownOption);
+        CHECK(error.element_index == 4);
+    }
+    REQUIRE(build);
+    CHECK(build->release.value());
+    CHECK(build->jobs.value == 4);
+    CHECK(verbose.nb_occurrences() == 1);
+    CHECK_FALSE(test_setup);
+    REQUIRE(app.selected_subcommand() != nullptr);
+    CHECK(app.selected_subcommand()->name() == "tool build");
+    CHECK(app.selected_subcommand()->usage().substr(0, 25) == "tool build [options]\n\nOpt");
+
+    {
+        char const * argv[] = {"", "test"};
+        app.parse({2, argv});
+        CHECK(test_setup);
+        CHECK(app.selected_subcommand()->name() == "tool test");
+    }
+    {
+        // Setup runs once
+        char const * argv[] = {"", "build"};
+        app.parse({2, argv});
+        CHECK(nb_build_setups == 1);
+        CHECK(app.selected_subcommand()->name() == "tool build");
+    }
+    {
+        // Not subcommands : names after '--', or after a positional
+        app.set_positionals(positionals);
+        char const * argv[] = {"", "file", "build", "--", "test"};
+        app.parse({5, argv});
+        CHECK(app.selected_subcommand() == nullptr);
+        CHECK(positionals.size() == 3);
+    }
+    {
+        char const * argv[] = {"", "-v"};
+        app.parse({2, argv});
+        CHECK(app.selected_subcommand() == nullptr);
+    }
+    CHECK(
+        app.usage().substr(app.usage().find("\nSubcommands:")) ==
+        "\nSubcommands:\n  build\n  test\n");
+
+    {
+        ParseResults results = app.make_results();
+        char const * argv[] = {"", "build"};
+        ParseError error;
+        CHECK_FALSE(app.try_parse({2, argv}, results, error));
+        CHECK(error.message() == "subcommand 'build' is not supported by const parsing");
+    }
+}
+
+TEST_CASE("const_parse") {
+    Application app{"test"};
+    Flag verbose{'v'};
+    app.add(verbose);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    factor.value = -1; // Default
+    app.add(factor);
+    OptionMultiple<int> inputs{'i', "input"};
+    inputs.value_name = "I";
+    app.add(inputs);
+
+    ParseResults results = app.make_results();
+    {
+        char const * argv[] = {"", "-v", "-f", "3", "-i1", "--input=2"};
+        app.parse({6, argv}, results);
+        CHECK(results.nb_occurrences(verbose) == 1);
+        CHECK(results.get(verbose));
+        CHECK(results.get(factor) == 3);
+        CHECK(results.get(inputs) == std::vector<int>{1, 2});
+    }
+    {
+        // Results are reset between parses
+        char const * argv[] = {"", "-i", "4"};
+        app.parse({3, argv}, results);
+        CHECK(!results.get(verbose));
+        CHECK(results.get(factor) == -1);
+        CHECK(results.get(inputs) == std::vector<int>{4});
+    }
+    // Options are not modified
+    CHECK(verbose.nb_occurrences() == 0);
+    CHECK(factor.value == -1);
+    CHECK(inputs.values.empty());
+
+    // Batch
+    constexpr std::size_t nb_lines = 1000;
+    std::vector<std::string> numbers;
+    for(std::size_t i = 0; i < nb_lines; ++i) {
+        numbers.push_back(std::to_string(i));
+    }
+    std::vector<std::array<char const *, 4>> argvs;
+    std::vector<CommandLine> command_lines;
+    argvs.reserve(nb_lines);
+    for(std::size_t i = 0; i < nb_lines; ++i) {
+        // Line 500 has an error
+        argvs.push_back({{"", "-f", i == 500 ? "x" : numbers[i].c_str(), "-v"}});
+        command_lines.emplace_back(4, argvs.back().data());
+    }
+    std::vector<int> parsed(nb_lines, -1);
+    std::vector<std::string> errors(nb_lines);
+    std::vector<std::size_t> error_elements(nb_lines, 0);
+    app.parse_batch(
+        Slice<CommandLine>{command_lines.data(), command_lines.size()},
+        [&](std::size_t index, ParseResults const & r, ParseError const * error) {
+            if(error != nullptr) {
+                // Usage is cached before threads start : readable from callbacks
+                errors[index] = error->message() + '\n' + std::string(app.usage());
+                error_elements[index] = error->element_index;
+            } else if(r.get(verbose)) {
+                parsed[index] = *r.get(factor);
+            }
+        },
+        4);
+    for(std::size_t i = 0; i < nb_lines; ++i) {
+        if(i == 500) {
+            CHECK(parsed[i] == -1);
+            CHECK(
+                errors[i] == "option 'factor': value 'N' is not a valid integer (int): 'x'\n" +
+                                 std::string(app.usage()));
+            CHECK(error_elements[i] == 2);
+        } else {
+            CHECK(parsed[i] == int(i));
+            CHECK(errors[i].empty());
+        }
+    }
+
+    CHECK_THROWS_AS(
+        app.parse_batch(
+            Slice<CommandLine>{command_lines.data(), command_lines.size()},
+            [](std::size_t, ParseResults const &, ParseError const *) {
+                throw std::runtime_error("stop");
+            }),
+        std::runtime_error);
+}
+
+TEST_CASE("incremental_parser") {
+    Application app{"test"};
+    Flag verbose{'v', "verbose"};
+    app.add(verbose);
+    OptionSingle<int> factor{'f', "factor"};
+    factor.value_name = "N";
+    app.add(factor);
+    OptionMultiple<std::tuple<int, int>> pairs{"pair"};
+    pairs.value_name = {"A", "B"};
+    app.add(pairs);
+    Positionals files;
+    app.set_positionals(files);
+
+    IncrementalParser parser{app};
+    ParseError error;
+    CHECK(parser.append("-v", error));
+    CHECK(parser.append("--pair", error));
+    CHECK_FALSE(parser.is_complete()); // Waiting for values
+    CHECK(parser.results().nb_occurrences(pairs) == 0);
+    CHECK_FALSE(parser.try_finish(error));
+    CHECK(error.code == ErrorCode::MissingValue);
+    CHECK(parser.append("1", error));
+    CHECK_FALSE(parser.append("x", error)); // Rejected, state unchanged
+    CHECK(error.code == ErrorCode::InvalidValue);
+    CHECK(error.element_index == 3);
+    CHECK(parser.size() == 3);
+    CHECK(parser.append("2", error));
+    CHECK(parser.is_complete());
+    CHECK(parser.results().get(pairs) == std::vector<std::tuple<int, int>>{{1, 2}});
+    std::size_t const checkpoint = parser.size();
+
+    CHECK(parser.append("--factor=3", error));
+    CHECK(parser.append("file", error));
+    CHECK(parser.append("--", error));
+    CHECK(parser.append("-v", error));
+    CHECK(parser.results().get(factor) == 3);
+    CHECK(parser.results().positionals().size() == 2);
+    CHECK(parser.try_finish(error));
+
+    // Edit the value of --pair : back in the middle of the option
+    parser.truncate(2);
+    CHECK_FALSE(parser.is_complete());
+    CHECK(parser.results().nb_occurrences(pairs) == 0);
+    CHECK_FALSE(parser.results().get(factor).has_value());
+    CHECK(parser.results().positionals().empty());
+    CHECK(parser.append("5", error));
+    CHECK(parser.append("6", error));
+    CHECK(parser.results().get(pairs) == std::vector<std::tuple<int, int>>{{5, 6}});
+    CHECK(parser.size() == checkpoint);
+
+    // '--' is rolled back too
+    CHECK(parser.append("--", error));
+    parser.truncate(checkpoint);
+    CHECK(parser.append("-f4", error));
+    CHECK(parser.results().get(factor) == 4);
+    CHECK_FALSE(parser.append("-f5", error)); // Repeated
+    CHECK(error.code == ErrorCode::RepeatedOption);
+    CHECK(parser.results().nb_occurrences(verbose) == 1);
+
+    // Rollback of a multi-valued option truncates its values (no copy of the previous ones)
+    OptionMultiple<int> inputs{"input"};
+    inputs.value_name = "I";
+    Application multi{"multi"};
+    multi.add(inputs);
+    IncrementalParser multi_parser{multi};
+    for(int i = 0; i < 3; ++i) {
+        CHECK(multi_parser.append("--input", error));
+        CHECK(multi_parser.append(std::to_string(i), error));
+    }
+    CHECK(multi_parser.append("--input", error));
+    CHECK_FALSE(multi_parser.append("x", error)); // Rejected append
+    CHECK(error.code == ErrorCode::InvalidValue);
+    CHECK(multi_parser.results().get(inputs) == std::vector<int>{0, 1, 2});
+    CHECK(multi_parser.results().nb_occurrences(inputs) == 3);
+    multi_parser.truncate(2);
+    CHECK(multi_parser.results().get(inputs) == std::vector<int>{0});
+    CHECK(multi_parser.results().nb_occurrences(inputs) == 1);
+    CHECK(multi_parser.append("--input=7", error));
+    CHECK(multi_parser.results().get(inputs) == std::vector<int>{0, 7});
+    CHECK(multi_parser.try_finish(error));
+}
+
+TEST_CASE("option_table") {
+    OptionTable table;
+    auto verbose = table.add_flag({'v', "verbose"});
+    auto factor = table.add_single<int>({'f', "factor"}, "N");
+    auto inputs = table.add_multiple<string_view>({'\0', "input"}, "I");
+    auto pairs = table.add_multiple<std::tuple<int, int>>({'p', ""}, {"A", "B"});
+    CHECK(table.nb_options() == 4);
+
+    char const * argv[] = {"", "-vf3", "--input=a", "--verbose", "-p", "1", "2", "--input", "b"};
+    table.parse({9, argv});
+    CHECK(table.value(verbose));
+    CHECK(table.nb_occurrences(verbose) == 2);
+    CHECK(table.value(factor) == 3);
+    CHECK(table.values(inputs) == std::vector<string_view>{"a", "b"});
+    CHECK(table.values(pairs) == std::vector<std::tuple<int, int>>{{1, 2}});
+
+    // Relocatable
+    OptionTable moved = std::move(table);
+    CHECK(moved.value(factor) == 3);
+    char const * argv2[] = {"", "-f", "4"};
+    ParseError error;
+    CHECK(!moved.try_parse({3, argv2}, error));
+    CHECK(error.message() == "option 'factor' cannot be used more than once");
+    char const * argv3[] = {"", "-p", "1", "x"};
+    CHECK(!moved.try_parse({4, argv3}, error));
+    CHECK(error.message() == "option 'p': value 'B' is not a valid integer (int): 'x'");
+    char const * argv_verbose[] = {"", "-v"};
+    CHECK(moved.try_parse({2, argv_verbose}, error)); // Same error object
+    CHECK(!error);
+    char const * argv4[] = {"", "--inputs"};
+    CHECK_THROWS_AS(moved.parse({2, argv4}), Exception);
 }
 
 TEST_CASE("temporary") {